@@ -7,8 +7,10 @@
 #include <uxtheme.h>
 #include <stdint.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <wchar.h>
 #include <bcrypt.h>
+#include <winioctl.h>
 
 #pragma comment(lib, "Bcrypt.lib")
 #pragma comment(lib, "Version.lib")
@@ -54,6 +56,40 @@ typedef struct {
 
 	volatile LONG lLastUiPctNotified; // init = -1
 
+	ULONGLONG ullResumedFrom;          // 追加续算：复用的前缀字节数（0 = 全量）
+
+	BOOL  bChunkManifest;              // 本次是否输出分块清单
+	BOOL  bChunkOk;
+	ULONGLONG ullChunkCount;
+
+	DWORD dwPieceSize;                 // 本次分片大小（0 = 不输出分片哈希）
+	BOOL  bPiecesOk;
+	ULONGLONG ullPieceCount;
+
+	int   nArchiveKind;                // 归档成员哈希：ARC_*（ARC_NONE = 不展开）
+	BOOL  bArchiveOk;
+	struct ARCHIVE_MEMBER* pMembers;   // 只在 g_csTasks 内重分配
+	LONG  nMembers;
+	LONG  nMembersCap;
+	volatile LONG lPendingMembers;     // 主遍读取 + 未完成的 zip 成员；归零时任务结束
+
+	LONG  lExportGen;                  // 已写入的导出批次（g_lExportGen），g_csExport 保护
+
+	ULONGLONG ullSparseBytes;          // 稀疏空洞补零、未读盘的字节数
+
+	volatile LONG lSvcWaiters;         // 服务模式：等待本任务结果的客户端位图，g_csTasks 内改动
+	ULONGLONG ullSvcLastUse;           // 服务模式：最近一次被请求的时刻，任务表满时按它淘汰
+	DWORD adwSvcSeq[32];               // 服务模式：各等待者最近一次请求的序号，与 lSvcWaiters 的位对应
+	BOOL  bRemote;                     // 瘦客户端：交给服务计算，结果由回填线程写入
+	BOOL  bRemoteSent;
+	DWORD dwRemoteSeq;                 // 瘦客户端：最近一次发出的请求序号，回填只认这一条
+	volatile LONG lRemoteDone;         // 回填/取消/断开三者只有一个收尾
+
+	WCHAR szCopyDest[MAX_PATH];        // 复制模式目标（空 = 只哈希）
+	BOOL  bCopyVerify;                 // 复制后无缓冲回读校验
+	BOOL  bCopyOk;                     // 目标已落地（校验通过或未要求校验）
+	int   nVerifyResult;               // COPY_VERIFY_*
+
 	PTP_WORK work;
 } FILE_HASH_TASK;
 
@@ -77,6 +113,29 @@ typedef struct {
 	LONGLONG llDoneBytes;
 	ULONGLONG ullStartTick;
 	ULONGLONG ullEndTick;
+
+	ULONGLONG ullResumedFrom;
+
+	BOOL bChunkManifest;
+	BOOL bChunkOk;
+	ULONGLONG ullChunkCount;
+
+	DWORD dwPieceSize;
+	BOOL bPiecesOk;
+	ULONGLONG ullPieceCount;
+
+	int  nArchiveKind;
+	BOOL bArchiveOk;
+	LONG nMembers;
+	LONG nMembersShown;
+	LONG iMemberFirst;     // 在成员快照数组中的起点
+
+	WCHAR szCopyDest[MAX_PATH];
+	BOOL bCopyVerify;
+	BOOL bCopyOk;
+	int  nVerifyResult;
+
+	ULONGLONG ullSparseBytes;
 } TASK_SNAPSHOT;
 
 // ---------------- 全局（保留核心状态） ----------------
@@ -107,6 +166,11 @@ static PTP_POOL g_pool = NULL;
 static TP_CALLBACK_ENVIRON g_callEnv;
 static LONG g_lPoolThreads = 0;
 static PTP_CLEANUP_GROUP g_cleanup = NULL;
+static DWORD g_dwCpuCount = 1;
+
+// 哈希车道线程池：多算法分核时每个算法占一个线程，与读线程池分开，避免互相占满
+static PTP_POOL g_lanePool = NULL;
+static TP_CALLBACK_ENVIRON g_laneEnv;
 
 // CNG providers（保留）
 static BCRYPT_ALG_HANDLE g_hAlgMD5 = NULL;
@@ -118,6 +182,43 @@ static DWORD g_dwHashLenMD5 = 0, g_dwHashLenSHA = 0;
 static HT_OnDirty g_cbDirty = NULL;
 static void* g_cbUser = NULL;
 
+// 追加续算缓存（append-aware）
+#define MAX_RESUME MAX_TASKS
+static const DWORD RESUME_TAIL_BYTES = 64 * 1024;
+
+typedef struct {
+	WCHAR szFilePath[MAX_PATH];
+	DWORD dwVolSerial;
+	ULONGLONG ullFileId;
+
+	ULONGLONG ullOffset;      // 中间态对应的已哈希字节数
+	DWORD dwTailLen;          // 尾块长度（<= RESUME_TAIL_BYTES）
+	BYTE  tailPrint[32];      // [ullOffset - dwTailLen, ullOffset) 的 SHA256
+
+	BCRYPT_HASH_HANDLE hMd5, hSha; // 未 Finish 的中间态副本
+	PUCHAR objMd5, objSha;
+
+	ULONGLONG ullGen;         // 每次写入递增，用于无锁读尾块后的复核
+	ULONGLONG ullLastUse;
+} RESUME_ENTRY;
+
+static RESUME_ENTRY g_Resume[MAX_RESUME];
+static int g_nResume = 0;
+static ULONGLONG g_ullResumeGen = 0;
+static CRITICAL_SECTION g_csResume;
+static volatile LONG g_bAppendAware = 0;
+
+// 分块清单输出（FastCDC）
+static volatile LONG g_bChunkManifest = 0;
+static WCHAR g_szChunkDir[MAX_PATH] = { 0 }; // 空 = 与源文件同目录；g_csTasks 保护
+
+// 分片哈希输出
+static volatile LONG g_lPieceSize = 0;       // 0 = 关闭
+static WCHAR g_szPieceDir[MAX_PATH] = { 0 }; // 同上
+
+// 归档成员流式哈希
+static volatile LONG g_bArchiveMembers = 0;
+
 static ULONGLONG NowTick64(void) { return GetTickCount64(); }
 
 // ---------------- 工具函数（原样） ----------------
@@ -216,6 +317,118 @@ static void MarkTextDirtyAndRequest(void)
 	RequestUiUpdate();
 }
 
+static void ExportOnTaskFinished(FILE_HASH_TASK* t);
+static void ServiceOnTaskFinished_Locked(FILE_HASH_TASK* t);
+static BOOL SvcConnActive(void);
+static void SvcConnSendPending(void);
+
+// 任务收尾：由最后一个完成的执行者调用（主遍或 zip 成员回调）。
+// bFinished 最后在 g_csTasks 内发布：监视/服务据此原地重算，届时导出与结果推送都已写完
+static void FinishTask(FILE_HASH_TASK* t)
+{
+	t->ullEndTick = NowTick64();
+	ExportOnTaskFinished(t);
+
+	EnterCriticalSection(&g_csTasks);
+	ServiceOnTaskFinished_Locked(t);
+	InterlockedExchange(&t->bFinished, 1);
+	InterlockedDecrement(&g_lRunningCount);
+	LeaveCriticalSection(&g_csTasks);
+
+	MarkTextDirtyAndRequest();
+}
+
+// ---------------- 内存预算（I/O 缓冲集中分配） ----------------
+// 读缓冲、复制/分核缓冲、zip 成员缓冲都从这里取；超出预算时先缩小本次缓冲，
+// 连最小值都给不出时等别的任务归还（全部取消或本任务取消都可打断）。
+// 报告文本缓冲单独记账：计入占用与峰值，但不占 I/O 预算——它只在 HT_Shutdown 时释放，
+// 若也从预算里扣，长时间运行后预算会被它永久占住。
+static const DWORD MEM_GRAIN = 64 * 1024;           // 缩小时的粒度，兼顾无缓冲 I/O 的扇区对齐
+static const DWORD IO_BUF_MIN = 256 * 1024;
+
+static CRITICAL_SECTION g_csMem;
+static CONDITION_VARIABLE g_cvMem;
+static ULONGLONG g_ullMemBudget = 0;                // 0 = 不限
+static LONGLONG g_llMemIo = 0;                      // g_csMem 保护；预算只约束这一项
+static LONGLONG g_llMemText = 0;                    // 只用于 HT_GetSummary 与峰值
+static LONGLONG g_llMemPeak = 0;
+
+static void MemNotePeak_Locked(void)
+{
+	LONGLONG cur = g_llMemIo + g_llMemText;
+	if (cur > g_llMemPeak) g_llMemPeak = cur;
+}
+
+// 申请 [cbMin, cbWant] 之间尽量大的缓冲，实际大小写入 *pcbGot。
+// bWait=FALSE 时预算不够直接返回 NULL（用于可有可无的附加缓冲，避免持有缓冲时再等待）；
+// pCancel 非空时等待中它变为非零也返回 NULL（通常是 &t->bCanceled）
+static BYTE* MemAcquire(DWORD cbWant, DWORD cbMin, DWORD* pcbGot, BOOL bWait, volatile LONG* pCancel)
+{
+	DWORD got = 0;
+	*pcbGot = 0;
+	if (cbMin > cbWant) cbMin = cbWant;
+
+	EnterCriticalSection(&g_csMem);
+	for (;;) {
+		got = cbWant;
+		if (g_ullMemBudget) {
+			LONGLONG avail = (LONGLONG)g_ullMemBudget - g_llMemIo;
+			if (avail < (LONGLONG)got) got = (avail > 0) ? (DWORD)avail & ~(MEM_GRAIN - 1) : 0;
+		}
+		if (got >= cbMin) break;
+
+		// 预算比单个最小缓冲还小：没有别人可等，照最小值放行，保证总能前进
+		if (bWait && g_llMemIo == 0) { got = cbMin; break; }
+		if (!bWait || InterlockedCompareExchange(&g_lCancelAll, 0, 0) != 0 ||
+			(pCancel && InterlockedCompareExchange(pCancel, 0, 0) != 0)) {
+			LeaveCriticalSection(&g_csMem);
+			return NULL;
+		}
+		SleepConditionVariableCS(&g_cvMem, &g_csMem, 200); // 超时用于响应取消
+	}
+	g_llMemIo += got;
+	MemNotePeak_Locked();
+	LeaveCriticalSection(&g_csMem);
+
+	BYTE* p = (BYTE*)VirtualAlloc(NULL, got, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (!p) {
+		EnterCriticalSection(&g_csMem);
+		g_llMemIo -= got;
+		LeaveCriticalSection(&g_csMem);
+		WakeAllConditionVariable(&g_cvMem);
+		return NULL;
+	}
+	*pcbGot = got;
+	return p;
+}
+
+static void MemRelease(BYTE* p, DWORD cb)
+{
+	if (!p) return;
+	VirtualFree(p, 0, MEM_RELEASE);
+
+	EnterCriticalSection(&g_csMem);
+	g_llMemIo -= cb;
+	LeaveCriticalSection(&g_csMem);
+	WakeAllConditionVariable(&g_cvMem);
+}
+
+static void MemResetPeak(void)
+{
+	EnterCriticalSection(&g_csMem);
+	g_llMemPeak = g_llMemIo + g_llMemText;
+	LeaveCriticalSection(&g_csMem);
+}
+
+static void MemAccountText(LONGLONG delta)
+{
+	EnterCriticalSection(&g_csMem);
+	g_llMemText += delta;
+	MemNotePeak_Locked();
+	LeaveCriticalSection(&g_csMem);
+	if (delta < 0) WakeAllConditionVariable(&g_cvMem);
+}
+
 // ---------------- 动态文本缓冲（原样） ----------------
 static BOOL EnsureTextCapacity(size_t cchNeed)
 {
@@ -239,6 +452,7 @@ static BOOL EnsureTextCapacity(size_t cchNeed)
 	}
 	if (!pNew) return FALSE;
 
+	MemAccountText((LONGLONG)(newCap - g_cchTextCap) * (LONGLONG)sizeof(WCHAR));
 	g_pTextBuf = pNew;
 	g_cchTextCap = newCap;
 	return TRUE;
@@ -311,235 +525,2721 @@ static void CleanupCngProviders(void)
 	if (g_hAlgSHA256) { BCryptCloseAlgorithmProvider(g_hAlgSHA256, 0); g_hAlgSHA256 = NULL; }
 }
 
-// ---------------- Hash 计算（原样：含 done 补齐） ----------------
-static BOOL CalculateHashes_WithProgress(FILE_HASH_TASK* t)
+static BOOL Sha256OfBuf(const BYTE* p, DWORD cb, BYTE out[32])
 {
-	if (!t) return FALSE;
-
 	BOOL ok = FALSE;
-	HANDLE hFile = INVALID_HANDLE_VALUE;
-	BYTE* buf = NULL;
-
-	ULONGLONG done = 0;
-	DWORD lastUi = 0;
-
-	NTSTATUS st = 0;
-	BCRYPT_HASH_HANDLE hMd5 = NULL, hSha = NULL;
-
-	PUCHAR objMd5 = NULL, objSha = NULL;
-	PUCHAR outMd5 = NULL, outSha = NULL;
-
-	LARGE_INTEGER sz; sz.QuadPart = 0;
-
-	hFile = CreateFileW(
-		t->szFilePath,
-		GENERIC_READ,
-		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
-		NULL, OPEN_EXISTING,
-		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
-		NULL
-	);
-	if (hFile == INVALID_HANDLE_VALUE) goto cleanup;
-
-	if (GetFileSizeEx(hFile, &sz)) {
-		t->ullFileSize = (ULONGLONG)sz.QuadPart;
+	BCRYPT_HASH_HANDLE h = NULL;
+	PUCHAR obj = (PUCHAR)HeapAlloc(GetProcessHeap(), 0, g_dwObjLenSHA);
+	if (!obj) return FALSE;
+
+	if (BCryptCreateHash(g_hAlgSHA256, &h, obj, g_dwObjLenSHA, NULL, 0, 0) == 0) {
+		ok = (BCryptHashData(h, (PUCHAR)p, cb, 0) == 0) &&
+			(BCryptFinishHash(h, out, 32, 0) == 0);
+		BCryptDestroyHash(h);
 	}
+	HeapFree(GetProcessHeap(), 0, obj);
+	return ok;
+}
 
-	if (t->bCalcMD5) {
-		objMd5 = (PUCHAR)HeapAlloc(GetProcessHeap(), 0, g_dwObjLenMD5);
-		outMd5 = (PUCHAR)HeapAlloc(GetProcessHeap(), 0, g_dwHashLenMD5);
-		if (!objMd5 || !outMd5) goto cleanup;
+// ---------------- 追加续算（append-aware） ----------------
+// CNG 的哈希中间态无法序列化，只能用 BCryptDuplicateHash 在进程内保留：
+// 缓存寿命等于 DLL 的加载期，Finish 之前复制一份即可在下次只哈希新增部分。
+// 不落盘：进程退出、HT_Shutdown 后首次哈希总是全量。要跨会话复用，让调用方连同一个
+// 常驻的 HT_RunService 进程（缓存跟着服务进程走）。改成落盘需要可序列化的 MD5/SHA-256
+// 软件实现，会让所有开启续算的文件放弃 CNG 的硬件加速，得不偿失。
+static BOOL GetFileIdentity(HANDLE hFile, DWORD* pVol, ULONGLONG* pId)
+{
+	BY_HANDLE_FILE_INFORMATION bhi;
+	if (!GetFileInformationByHandle(hFile, &bhi)) return FALSE;
+	*pVol = bhi.dwVolumeSerialNumber;
+	*pId = ((ULONGLONG)bhi.nFileIndexHigh << 32) | bhi.nFileIndexLow;
+	return TRUE;
+}
 
-		st = BCryptCreateHash(g_hAlgMD5, &hMd5, objMd5, g_dwObjLenMD5, NULL, 0, 0);
-		if (st != 0) goto cleanup;
+// 读取 [end - len, end) 计算尾块指纹；buf 至少 RESUME_TAIL_BYTES
+static BOOL TailFingerprint(HANDLE hFile, ULONGLONG end, DWORD len, BYTE* buf, BYTE print[32])
+{
+	LARGE_INTEGER pos; pos.QuadPart = (LONGLONG)(end - len);
+	if (!SetFilePointerEx(hFile, pos, NULL, FILE_BEGIN)) return FALSE;
+
+	DWORD got = 0;
+	while (got < len) {
+		DWORD r = 0;
+		if (!ReadFile(hFile, buf + got, len - got, &r, NULL) || r == 0) return FALSE;
+		got += r;
 	}
+	return Sha256OfBuf(buf, len, print);
+}
 
-	if (t->bCalcSHA256) {
-		objSha = (PUCHAR)HeapAlloc(GetProcessHeap(), 0, g_dwObjLenSHA);
-		outSha = (PUCHAR)HeapAlloc(GetProcessHeap(), 0, g_dwHashLenSHA);
-		if (!objSha || !outSha) goto cleanup;
+static void ResumeFreeEntry(RESUME_ENTRY* e)
+{
+	if (e->hMd5) BCryptDestroyHash(e->hMd5);
+	if (e->hSha) BCryptDestroyHash(e->hSha);
+	if (e->objMd5) HeapFree(GetProcessHeap(), 0, e->objMd5);
+	if (e->objSha) HeapFree(GetProcessHeap(), 0, e->objSha);
+	ZeroMemory(e, sizeof(*e));
+}
 
-		st = BCryptCreateHash(g_hAlgSHA256, &hSha, objSha, g_dwObjLenSHA, NULL, 0, 0);
-		if (st != 0) goto cleanup;
+static RESUME_ENTRY* ResumeFind_Locked(const WCHAR* path)
+{
+	for (int i = 0; i < g_nResume; i++) {
+		if (_wcsicmp(g_Resume[i].szFilePath, path) == 0) return &g_Resume[i];
 	}
+	return NULL;
+}
 
-	buf = (BYTE*)VirtualAlloc(NULL, IO_BUF_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
-	if (!buf) goto cleanup;
+static void ResumeDrop(const WCHAR* path)
+{
+	EnterCriticalSection(&g_csResume);
+	RESUME_ENTRY* e = ResumeFind_Locked(path);
+	if (e) {
+		ResumeFreeEntry(e);
+		RESUME_ENTRY* last = &g_Resume[g_nResume - 1];
+		if (e != last) {
+			*e = *last;
+			ZeroMemory(last, sizeof(*last));
+		}
+		g_nResume--;
+	}
+	LeaveCriticalSection(&g_csResume);
+}
 
-	done = 0;
-	lastUi = GetTickCount();
-	InterlockedExchange64(&t->llDoneBytes, 0);
+static void ResumeDropAll(void)
+{
+	EnterCriticalSection(&g_csResume);
+	for (int i = 0; i < g_nResume; i++) ResumeFreeEntry(&g_Resume[i]);
+	g_nResume = 0;
+	LeaveCriticalSection(&g_csResume);
+}
 
-	ok = TRUE;
+// 命中且文件只增长、尾块指纹一致时：用缓存的中间态替换 *phMd5/*phSha，
+// 文件指针定位到续算点并返回该偏移；否则回到文件头并返回 0（全量）。
+// 复制失败时句柄会被重新创建为初始态，调用方需检查句柄是否为 NULL。
+static ULONGLONG ResumeTryRestore(FILE_HASH_TASK* t, HANDLE hFile, BYTE* buf,
+	BCRYPT_HASH_HANDLE* phMd5, PUCHAR objMd5, BCRYPT_HASH_HANDLE* phSha, PUCHAR objSha)
+{
+	DWORD vol = 0;
+	ULONGLONG id = 0;
+	if (!GetFileIdentity(hFile, &vol, &id)) return 0;
+
+	RESUME_ENTRY probe;
+	BOOL found = FALSE;
+	EnterCriticalSection(&g_csResume);
+	RESUME_ENTRY* e = ResumeFind_Locked(t->szFilePath);
+	if (e) { probe = *e; found = TRUE; }
+	LeaveCriticalSection(&g_csResume);
+	if (!found) return 0;
+
+	// 被替换、被截断：缓存作废
+	if (probe.dwVolSerial != vol || probe.ullFileId != id || probe.ullOffset > t->ullFileSize) {
+		ResumeDrop(t->szFilePath);
+		return 0;
+	}
+	// 算法集不覆盖：本次全量，结束时覆盖缓存
+	if ((t->bCalcMD5 && !probe.hMd5) || (t->bCalcSHA256 && !probe.hSha)) return 0;
+
+	ULONGLONG resumeAt = 0;
+	BYTE print[32];
+	if (TailFingerprint(hFile, probe.ullOffset, probe.dwTailLen, buf, print) &&
+		memcmp(print, probe.tailPrint, sizeof(print)) == 0) {
+
+		EnterCriticalSection(&g_csResume);
+		e = ResumeFind_Locked(t->szFilePath);
+		if (e && e->ullGen == probe.ullGen) {
+			BOOL dupOk = TRUE;
+			if (*phMd5) {
+				BCryptDestroyHash(*phMd5); *phMd5 = NULL;
+				dupOk = (BCryptDuplicateHash(e->hMd5, phMd5, objMd5, g_dwObjLenMD5, 0) == 0);
+			}
+			if (dupOk && *phSha) {
+				BCryptDestroyHash(*phSha); *phSha = NULL;
+				dupOk = (BCryptDuplicateHash(e->hSha, phSha, objSha, g_dwObjLenSHA, 0) == 0);
+			}
 
-	for (;;) {
-		if (InterlockedCompareExchange(&g_lCancelAll, 0, 0) != 0) {
-			InterlockedExchange(&t->bCanceled, 1);
-			ok = FALSE;
-			break;
+			if (dupOk) {
+				resumeAt = e->ullOffset;
+				e->ullLastUse = NowTick64();
+			}
+			else {
+				if (*phMd5) { BCryptDestroyHash(*phMd5); *phMd5 = NULL; }
+				if (*phSha) { BCryptDestroyHash(*phSha); *phSha = NULL; }
+				if (t->bCalcMD5) BCryptCreateHash(g_hAlgMD5, phMd5, objMd5, g_dwObjLenMD5, NULL, 0, 0);
+				if (t->bCalcSHA256) BCryptCreateHash(g_hAlgSHA256, phSha, objSha, g_dwObjLenSHA, NULL, 0, 0);
+			}
 		}
+		LeaveCriticalSection(&g_csResume);
+	}
+	else {
+		ResumeDrop(t->szFilePath);
+	}
 
-		DWORD dwRead = 0;
-		BOOL br = ReadFile(hFile, buf, IO_BUF_SIZE, &dwRead, NULL);
-		if (!br) { ok = FALSE; break; }
-		if (dwRead == 0) break;
+	LARGE_INTEGER pos; pos.QuadPart = (LONGLONG)resumeAt;
+	if (!SetFilePointerEx(hFile, pos, NULL, FILE_BEGIN)) return 0;
+	return resumeAt;
+}
 
-		if (hMd5) {
-			st = BCryptHashData(hMd5, (PUCHAR)buf, dwRead, 0);
-			if (st != 0) { ok = FALSE; break; }
-		}
-		if (hSha) {
-			st = BCryptHashData(hSha, (PUCHAR)buf, dwRead, 0);
-			if (st != 0) { ok = FALSE; break; }
-		}
+// 在 BCryptFinishHash 之前调用：保存 hashed 处的中间态与尾块指纹
+static void ResumeSave(FILE_HASH_TASK* t, HANDLE hFile, BYTE* buf, ULONGLONG hashed,
+	BCRYPT_HASH_HANDLE hMd5, BCRYPT_HASH_HANDLE hSha)
+{
+	RESUME_ENTRY ne;
+	ZeroMemory(&ne, sizeof(ne));
 
-		done += dwRead;
-		InterlockedExchange64(&t->llDoneBytes, (LONGLONG)done);
-		InterlockedAdd64(&g_llDoneBytesAll, (LONGLONG)dwRead);
+	if (hashed == 0) return;
+	if (!GetFileIdentity(hFile, &ne.dwVolSerial, &ne.ullFileId)) return;
 
-		DWORD now = GetTickCount();
-		if (now - lastUi >= UI_THROTTLE_MS_WORKER) {
-			lastUi = now;
+	ne.dwTailLen = (hashed < RESUME_TAIL_BYTES) ? (DWORD)hashed : RESUME_TAIL_BYTES;
+	if (!TailFingerprint(hFile, hashed, ne.dwTailLen, buf, ne.tailPrint)) return;
 
-			LONG pct = 0;
-			ULONGLONG fs = t->ullFileSize;
-			if (fs > 0) {
-				double dp = (double)done * 100.0 / (double)fs;
-				if (dp < 0) dp = 0;
-				if (dp > 100) dp = 100;
-				pct = (LONG)(dp + 0.5);
-			}
+	StringCchCopyW(ne.szFilePath, _countof(ne.szFilePath), t->szFilePath);
+	ne.ullOffset = hashed;
 
-			LONG lastPct = InterlockedCompareExchange(&t->lLastUiPctNotified, 0, 0);
-			if (pct >= lastPct + 1 || pct == 100 || lastPct < 0) {
-				InterlockedExchange(&t->lLastUiPctNotified, pct);
-				InterlockedExchange(&g_bTextDirty, 1);
-			}
-			RequestUiUpdate();
-		}
+	if (hMd5) {
+		ne.objMd5 = (PUCHAR)HeapAlloc(GetProcessHeap(), 0, g_dwObjLenMD5);
+		if (!ne.objMd5 || BCryptDuplicateHash(hMd5, &ne.hMd5, ne.objMd5, g_dwObjLenMD5, 0) != 0) goto fail;
 	}
-
-	// ✅ 对账补齐（原样）
-	if (InterlockedCompareExchange(&t->bCanceled, 0, 0) == 0) {
-		ULONGLONG fileSize = t->ullFileSize;
-		if (done > fileSize) done = fileSize;
-
-		if (done < fileSize) {
-			LONGLONG remain = (LONGLONG)(fileSize - done);
-			InterlockedAdd64(&g_llDoneBytesAll, remain);
-			done = fileSize;
-			InterlockedExchange64(&t->llDoneBytes, (LONGLONG)done);
-		}
+	if (hSha) {
+		ne.objSha = (PUCHAR)HeapAlloc(GetProcessHeap(), 0, g_dwObjLenSHA);
+		if (!ne.objSha || BCryptDuplicateHash(hSha, &ne.hSha, ne.objSha, g_dwObjLenSHA, 0) != 0) goto fail;
 	}
 
-	if (ok) {
-		if (hMd5) {
-			st = BCryptFinishHash(hMd5, outMd5, g_dwHashLenMD5, 0);
-			if (st == 0) {
-				BinToHexUpper(outMd5, g_dwHashLenMD5, t->szMD5Value, _countof(t->szMD5Value));
-				t->bSuccessMD5 = TRUE;
-			}
-			else {
-				t->bSuccessMD5 = FALSE;
-			}
-		}
-		if (hSha) {
-			st = BCryptFinishHash(hSha, outSha, g_dwHashLenSHA, 0);
-			if (st == 0) {
-				BinToHexUpper(outSha, g_dwHashLenSHA, t->szSHA256Value, _countof(t->szSHA256Value));
-				t->bSuccessSHA256 = TRUE;
+	EnterCriticalSection(&g_csResume);
+	{
+		RESUME_ENTRY* e = ResumeFind_Locked(t->szFilePath);
+		if (!e) {
+			if (g_nResume < MAX_RESUME) {
+				e = &g_Resume[g_nResume++];
 			}
 			else {
-				t->bSuccessSHA256 = FALSE;
+				e = &g_Resume[0];
+				for (int i = 1; i < g_nResume; i++) {
+					if (g_Resume[i].ullLastUse < e->ullLastUse) e = &g_Resume[i];
+				}
 			}
 		}
-	}
+		ResumeFreeEntry(e);
 
-cleanup:
-	if (buf) VirtualFree(buf, 0, MEM_RELEASE);
-
-	if (hMd5) BCryptDestroyHash(hMd5);
-	if (hSha) BCryptDestroyHash(hSha);
+		ne.ullGen = ++g_ullResumeGen;
+		ne.ullLastUse = NowTick64();
+		*e = ne;
+	}
+	LeaveCriticalSection(&g_csResume);
+	return;
 
-	if (objMd5) HeapFree(GetProcessHeap(), 0, objMd5);
-	if (objSha) HeapFree(GetProcessHeap(), 0, objSha);
-	if (outMd5) HeapFree(GetProcessHeap(), 0, outMd5);
-	if (outSha) HeapFree(GetProcessHeap(), 0, outSha);
+fail:
+	ResumeFreeEntry(&ne);
+}
 
-	if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+// ---------------- 旁路文件（分块清单 / 分片哈希共用） ----------------
+// 先写 <目标>.tmp，头部占位；成功结束时回填头部再改名，失败则删除临时文件。
+static const DWORD SIDECAR_WBUF_SIZE = 64 * 1024;
 
-	InterlockedExchange(&g_bTextDirty, 1);
-	RequestUiUpdate();
-	return ok;
+typedef struct {
+	HANDLE hOut;
+	WCHAR  szTmpPath[MAX_PATH];
+	WCHAR  szOutPath[MAX_PATH];
+	BYTE*  wbuf;
+	DWORD  wlen;
+	BOOL   bFailed;
+} SIDECAR_OUT;
+
+// dir 为空时与源文件同目录，否则放到 dir 下（仅取文件名）
+static BOOL BuildSidecarPath(const WCHAR* filePath, const WCHAR* dir, const WCHAR* ext, WCHAR* out, size_t cch)
+{
+	if (dir && dir[0]) {
+		const WCHAR* name = wcsrchr(filePath, L'\\');
+		name = name ? name + 1 : filePath;
+		size_t n = wcslen(dir);
+		const WCHAR* sep = (dir[n - 1] == L'\\' || dir[n - 1] == L'/') ? L"" : L"\\";
+		return SUCCEEDED(StringCchPrintfW(out, cch, L"%s%s%s%s", dir, sep, name, ext));
+	}
+	return SUCCEEDED(StringCchPrintfW(out, cch, L"%s%s", filePath, ext));
 }
 
-// ---------------- 线程池管理（原样） ----------------
-static void EnsureThreadPool(void)
+static BOOL SidecarWrite(SIDECAR_OUT* o, const void* p, DWORD cb)
 {
-	if (g_pool) return;
+	if (o->bFailed) return FALSE;
+	if (o->wlen + cb > SIDECAR_WBUF_SIZE) {
+		DWORD w = 0;
+		if (!WriteFile(o->hOut, o->wbuf, o->wlen, &w, NULL) || w != o->wlen) { o->bFailed = TRUE; return FALSE; }
+		o->wlen = 0;
+	}
+	memcpy(o->wbuf + o->wlen, p, cb);
+	o->wlen += cb;
+	return TRUE;
+}
 
-	g_pool = CreateThreadpool(NULL);
-	if (!g_pool) return;
+static BOOL SidecarOpenPath(SIDECAR_OUT* o, const WCHAR* outPath, DWORD cbHeader)
+{
+	ZeroMemory(o, sizeof(*o));
+	o->hOut = INVALID_HANDLE_VALUE;
+	o->bFailed = TRUE;
 
-	g_cleanup = CreateThreadpoolCleanupGroup();
-	if (!g_cleanup) {
-		CloseThreadpool(g_pool);
-		g_pool = NULL;
-		return;
-	}
+	if (FAILED(StringCchCopyW(o->szOutPath, _countof(o->szOutPath), outPath))) return FALSE;
+	if (FAILED(StringCchPrintfW(o->szTmpPath, _countof(o->szTmpPath), L"%s.tmp", o->szOutPath))) return FALSE;
 
-	InitializeThreadpoolEnvironment(&g_callEnv);
-	SetThreadpoolCallbackPool(&g_callEnv, g_pool);
-	SetThreadpoolCallbackCleanupGroup(&g_callEnv, g_cleanup, NULL);
+	o->wbuf = (BYTE*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, SIDECAR_WBUF_SIZE);
+	if (!o->wbuf) return FALSE;
 
-	SYSTEM_INFO si; GetSystemInfo(&si);
-	LONG n = (LONG)(si.dwNumberOfProcessors ? si.dwNumberOfProcessors : 1);
-	if (n < 1) n = 1;
-	g_lPoolThreads = n;
+	o->hOut = CreateFileW(o->szTmpPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (o->hOut == INVALID_HANDLE_VALUE) return FALSE;
 
-	SetThreadpoolThreadMinimum(g_pool, (DWORD)n);
-	SetThreadpoolThreadMaximum(g_pool, (DWORD)n);
+	o->bFailed = FALSE;
+	o->wlen = cbHeader; // 头部占位（已清零）
+	return TRUE;
 }
 
-static void ApplyThreadPoolSize(LONG n)
+static BOOL SidecarOpen(SIDECAR_OUT* o, const WCHAR* filePath, const WCHAR* dir, const WCHAR* ext, DWORD cbHeader)
 {
-	if (!g_pool) return;
-	if (n < 1) n = 1;
-	if (n > 64) n = 64;
-
-	SetThreadpoolThreadMaximum(g_pool, (DWORD)n);
-	SetThreadpoolThreadMinimum(g_pool, (DWORD)n);
-	g_lPoolThreads = n;
+	WCHAR outPath[MAX_PATH];
+	if (!BuildSidecarPath(filePath, dir, ext, outPath, _countof(outPath))) {
+		ZeroMemory(o, sizeof(*o));
+		o->hOut = INVALID_HANDLE_VALUE;
+		o->bFailed = TRUE;
+		return FALSE;
+	}
+	return SidecarOpenPath(o, outPath, cbHeader);
 }
 
-// ---------------- WorkCallback（原样：total delta 修正唯一点） ----------------
-static VOID CALLBACK WorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
+// commit=FALSE 时丢弃；返回旁路文件是否落盘
+static BOOL SidecarClose(SIDECAR_OUT* o, BOOL commit, const void* header, DWORD cbHeader)
 {
-	(void)Instance; (void)Work;
-	FILE_HASH_TASK* t = (FILE_HASH_TASK*)Context;
-	if (!t) return;
+	if (commit && !o->bFailed && o->hOut != INVALID_HANDLE_VALUE) {
+		DWORD w = 0;
+		if (o->wlen && (!WriteFile(o->hOut, o->wbuf, o->wlen, &w, NULL) || w != o->wlen)) o->bFailed = TRUE;
+
+		LARGE_INTEGER zero; zero.QuadPart = 0;
+		if (!o->bFailed &&
+			(!SetFilePointerEx(o->hOut, zero, NULL, FILE_BEGIN) ||
+				!WriteFile(o->hOut, header, cbHeader, &w, NULL) || w != cbHeader)) o->bFailed = TRUE;
+	}
+	else {
+		o->bFailed = TRUE;
+	}
 
-	t->ullStartTick = NowTick64();
+	if (o->hOut != INVALID_HANDLE_VALUE) { CloseHandle(o->hOut); o->hOut = INVALID_HANDLE_VALUE; }
+	if (o->wbuf) { HeapFree(GetProcessHeap(), 0, o->wbuf); o->wbuf = NULL; }
 
-	WIN32_FILE_ATTRIBUTE_DATA fad = { 0 };
-	if (GetFileAttributesExW(t->szFilePath, GetFileExInfoStandard, &fad)) {
-		t->ftModify = fad.ftLastWriteTime;
-		GetFileVersionStr(t->szFilePath, t->szFileVersion, _countof(t->szFileVersion));
+	BOOL ok = FALSE;
+	if (o->szTmpPath[0]) {
+		ok = !o->bFailed && MoveFileExW(o->szTmpPath, o->szOutPath, MOVEFILE_REPLACE_EXISTING);
+		if (!ok) DeleteFileW(o->szTmpPath);
+		o->szTmpPath[0] = L'\0';
 	}
+	return ok;
+}
 
-	ULONGLONG realSize = t->ullFileSizeInit;
-	HANDLE hf = CreateFileW(
-		t->szFilePath, GENERIC_READ,
-		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
-		NULL, OPEN_EXISTING,
-		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
-		NULL
-	);
-	if (hf != INVALID_HANDLE_VALUE) {
-		LARGE_INTEGER li;
-		if (GetFileSizeEx(hf, &li)) realSize = (ULONGLONG)li.QuadPart;
-		CloseHandle(hf);
-	}
+// ---------------- 内容定义分块（FastCDC）与分块清单 ----------------
+// gear 表由固定种子生成，保证不同机器/版本产出的切点一致，清单才可比较。
+static const DWORD CDC_MIN = 16 * 1024;
+static const DWORD CDC_AVG = 64 * 1024;
+static const DWORD CDC_MAX = 256 * 1024;
+static const uint64_t CDC_MASK_S = ((1ULL << 18) - 1) << 46; // 未到 avg：更难切
+static const uint64_t CDC_MASK_L = ((1ULL << 14) - 1) << 50; // 超过 avg：更易切
+
+static const DWORD CDC_MANIFEST_MAGIC = 0x4D435448; // 'HTCM'
+
+#pragma pack(push, 1)
+typedef struct {
+	DWORD dwMagic;
+	WORD  wVersion;
+	WORD  wDigestLen;
+	DWORD dwMin, dwAvg, dwMax;
+	DWORD dwReserved;
+	ULONGLONG ullCount;
+	ULONGLONG ullFileSize;
+} CDC_MANIFEST_HEADER;
+
+typedef struct {
+	ULONGLONG ullOffset;
+	DWORD dwLength;
+	BYTE  digest[32];         // SHA256
+} CDC_MANIFEST_ENTRY;
+#pragma pack(pop)
+
+typedef struct {
+	SIDECAR_OUT out;
+
+	ULONGLONG ullChunkStart;
+	DWORD  dwChunkLen;
+	uint64_t fp;
+
+	BCRYPT_HASH_HANDLE hChunk;
+	PUCHAR objChunk;
+
+	ULONGLONG ullCount;
+	BOOL   bFailed;
+} CDC_STATE;
+
+static uint64_t g_Gear[256];
+
+static void CdcInitGear(void)
+{
+	uint64_t x = 0x48617368546F6F6CULL; // "HashTool"
+	for (int i = 0; i < 256; i++) {
+		// splitmix64
+		uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		g_Gear[i] = z ^ (z >> 31);
+	}
+}
+
+static BOOL CdcBeginChunk(CDC_STATE* c)
+{
+	c->dwChunkLen = 0;
+	c->fp = 0;
+	return BCryptCreateHash(g_hAlgSHA256, &c->hChunk, c->objChunk, g_dwObjLenSHA, NULL, 0, 0) == 0;
+}
+
+static BOOL CdcEmitChunk(CDC_STATE* c)
+{
+	CDC_MANIFEST_ENTRY e;
+	e.ullOffset = c->ullChunkStart;
+	e.dwLength = c->dwChunkLen;
+
+	NTSTATUS st = BCryptFinishHash(c->hChunk, e.digest, sizeof(e.digest), 0);
+	BCryptDestroyHash(c->hChunk);
+	c->hChunk = NULL;
+	if (st != 0) return FALSE;
+	if (!SidecarWrite(&c->out, &e, sizeof(e))) return FALSE;
+
+	c->ullCount++;
+	c->ullChunkStart += c->dwChunkLen;
+	return CdcBeginChunk(c);
+}
+
+// 在 [p, p+n) 中寻找切点；返回本次归入当前块的字节数，*pCut 表示是否在末尾切块
+static DWORD CdcScan(CDC_STATE* c, const BYTE* p, DWORD n, BOOL* pCut)
+{
+	DWORD i = 0;
+	DWORD len = c->dwChunkLen;
+	uint64_t fp = c->fp;
+	*pCut = FALSE;
+
+	// min 之前不可能切块，直接跳过不算指纹
+	if (len < CDC_MIN) {
+		DWORD skip = CDC_MIN - len;
+		if (skip > n) skip = n;
+		i += skip; len += skip;
+	}
+
+	DWORD endS = (len < CDC_AVG) ? (CDC_AVG - len) : 0;
+	if (endS > n - i) endS = n - i;
+	for (DWORD k = 0; k < endS; k++, i++) {
+		fp = (fp << 1) + g_Gear[p[i]];
+		if ((fp & CDC_MASK_S) == 0) { c->fp = fp; *pCut = TRUE; return i + 1; }
+	}
+	len += endS;
+
+	DWORD endL = (len < CDC_MAX) ? (CDC_MAX - len) : 0;
+	if (endL > n - i) endL = n - i;
+	for (DWORD k = 0; k < endL; k++, i++) {
+		fp = (fp << 1) + g_Gear[p[i]];
+		if ((fp & CDC_MASK_L) == 0) { c->fp = fp; *pCut = TRUE; return i + 1; }
+	}
+	len += endL;
+
+	c->fp = fp;
+	if (len >= CDC_MAX) *pCut = TRUE;
+	return i;
+}
+
+static BOOL CdcBegin(CDC_STATE* c, const WCHAR* filePath, const WCHAR* outDir)
+{
+	ZeroMemory(c, sizeof(*c));
+
+	if (!SidecarOpen(&c->out, filePath, outDir, L".htcm", sizeof(CDC_MANIFEST_HEADER))) return FALSE;
+	c->objChunk = (PUCHAR)HeapAlloc(GetProcessHeap(), 0, g_dwObjLenSHA);
+	if (!c->objChunk) return FALSE;
+
+	return CdcBeginChunk(c);
+}
+
+static void CdcFeed(CDC_STATE* c, const BYTE* p, DWORD n)
+{
+	while (n > 0 && !c->bFailed) {
+		BOOL cut = FALSE;
+		DWORD take = CdcScan(c, p, n, &cut);
+
+		if (take && BCryptHashData(c->hChunk, (PUCHAR)p, take, 0) != 0) { c->bFailed = TRUE; break; }
+		c->dwChunkLen += take;
+		if (cut && !CdcEmitChunk(c)) { c->bFailed = TRUE; break; }
+
+		p += take; n -= take;
+	}
+}
+
+// ok=FALSE 时丢弃临时文件；返回清单是否落盘
+static BOOL CdcEnd(CDC_STATE* c, BOOL ok)
+{
+	if (ok && !c->bFailed && c->dwChunkLen > 0) {
+		if (!CdcEmitChunk(c)) c->bFailed = TRUE;
+	}
+	if (c->hChunk) { BCryptDestroyHash(c->hChunk); c->hChunk = NULL; }
+	if (c->objChunk) { HeapFree(GetProcessHeap(), 0, c->objChunk); c->objChunk = NULL; }
+
+	CDC_MANIFEST_HEADER h;
+	ZeroMemory(&h, sizeof(h));
+	h.dwMagic = CDC_MANIFEST_MAGIC;
+	h.wVersion = 1;
+	h.wDigestLen = 32;
+	h.dwMin = CDC_MIN; h.dwAvg = CDC_AVG; h.dwMax = CDC_MAX;
+	h.ullCount = c->ullCount;
+	h.ullFileSize = c->ullChunkStart;
+
+	return SidecarClose(&c->out, ok && !c->bFailed, &h, sizeof(h));
+}
+
+// 逐条读取清单（带缓冲），供比较使用
+typedef struct {
+	HANDLE h;
+	BYTE*  buf;
+	DWORD  len, pos;
+	CDC_MANIFEST_HEADER hdr;
+	ULONGLONG ullLeft;
+} CDC_READER;
+
+static BOOL CdcReaderOpen(CDC_READER* r, const WCHAR* path)
+{
+	ZeroMemory(r, sizeof(*r));
+	r->h = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (r->h == INVALID_HANDLE_VALUE) return FALSE;
+
+	DWORD got = 0;
+	if (!ReadFile(r->h, &r->hdr, sizeof(r->hdr), &got, NULL) || got != sizeof(r->hdr)) return FALSE;
+	if (r->hdr.dwMagic != CDC_MANIFEST_MAGIC || r->hdr.wVersion != 1 || r->hdr.wDigestLen != 32) return FALSE;
+
+	r->buf = (BYTE*)HeapAlloc(GetProcessHeap(), 0, SIDECAR_WBUF_SIZE);
+	r->ullLeft = r->hdr.ullCount;
+	return r->buf != NULL;
+}
+
+static BOOL CdcReaderNext(CDC_READER* r, CDC_MANIFEST_ENTRY* e)
+{
+	if (r->ullLeft == 0) return FALSE;
+	if (r->len - r->pos < sizeof(*e)) {
+		DWORD keep = r->len - r->pos;
+		memmove(r->buf, r->buf + r->pos, keep);
+		DWORD got = 0;
+		if (!ReadFile(r->h, r->buf + keep, SIDECAR_WBUF_SIZE - keep, &got, NULL)) return FALSE;
+		r->len = keep + got;
+		r->pos = 0;
+		if (r->len < sizeof(*e)) return FALSE;
+	}
+	memcpy(e, r->buf + r->pos, sizeof(*e));
+	r->pos += sizeof(*e);
+	r->ullLeft--;
+	return TRUE;
+}
+
+static void CdcReaderClose(CDC_READER* r)
+{
+	if (r->h && r->h != INVALID_HANDLE_VALUE) CloseHandle(r->h);
+	if (r->buf) HeapFree(GetProcessHeap(), 0, r->buf);
+	ZeroMemory(r, sizeof(*r));
+}
+
+// 比较用的摘要键：取 SHA256 前 16 字节，足以区分块
+typedef struct { ULONGLONG a, b; } CDC_KEY;
+
+static int __cdecl CdcKeyCmp(const void* x, const void* y)
+{
+	const CDC_KEY* p = (const CDC_KEY*)x;
+	const CDC_KEY* q = (const CDC_KEY*)y;
+	if (p->a != q->a) return (p->a < q->a) ? -1 : 1;
+	if (p->b != q->b) return (p->b < q->b) ? -1 : 1;
+	return 0;
+}
+
+// ---------------- 固定分片哈希（piece list）与分片校验 ----------------
+// 分片大小取 2 的幂且不超过 IO_BUF_SIZE，保证与读缓冲对齐。
+static const DWORD PIECE_MIN_SIZE = 64 * 1024;
+static const DWORD PIECE_DEFAULT_SIZE = 4 * 1024 * 1024;
+static const DWORD PIECE_LIST_MAGIC = 0x43505448; // 'HTPC'
+
+#pragma pack(push, 1)
+typedef struct {
+	DWORD dwMagic;
+	WORD  wVersion;
+	WORD  wDigestLen;
+	DWORD dwPieceSize;
+	DWORD dwReserved;
+	ULONGLONG ullFileSize;
+	ULONGLONG ullCount;
+} PIECE_LIST_HEADER;
+#pragma pack(pop)
+
+typedef struct {
+	SIDECAR_OUT out;
+	DWORD dwPieceSize;
+	DWORD dwPieceLen;
+	ULONGLONG ullFileSize;
+	ULONGLONG ullCount;
+
+	BCRYPT_HASH_HANDLE hPiece;
+	PUCHAR objPiece;
+	BOOL bFailed;
+} PIECE_STATE;
+
+static DWORD NormalizePieceSize(DWORD cb)
+{
+	if (cb == 0) return 0;
+	DWORD p = PIECE_MIN_SIZE;
+	while (p < cb && p < IO_BUF_SIZE) p <<= 1;
+	return p;
+}
+
+static BOOL PieceBegin(PIECE_STATE* ps, const WCHAR* filePath, const WCHAR* outDir, DWORD pieceSize)
+{
+	ZeroMemory(ps, sizeof(*ps));
+	ps->dwPieceSize = pieceSize;
+
+	if (!SidecarOpen(&ps->out, filePath, outDir, L".htpc", sizeof(PIECE_LIST_HEADER))) return FALSE;
+	ps->objPiece = (PUCHAR)HeapAlloc(GetProcessHeap(), 0, g_dwObjLenSHA);
+	if (!ps->objPiece) return FALSE;
+
+	return BCryptCreateHash(g_hAlgSHA256, &ps->hPiece, ps->objPiece, g_dwObjLenSHA, NULL, 0, 0) == 0;
+}
+
+static BOOL PieceEmit(PIECE_STATE* ps)
+{
+	BYTE digest[32];
+	NTSTATUS st = BCryptFinishHash(ps->hPiece, digest, sizeof(digest), 0);
+	BCryptDestroyHash(ps->hPiece);
+	ps->hPiece = NULL;
+	if (st != 0) return FALSE;
+	if (!SidecarWrite(&ps->out, digest, sizeof(digest))) return FALSE;
+
+	ps->ullCount++;
+	ps->ullFileSize += ps->dwPieceLen;
+	ps->dwPieceLen = 0;
+	return BCryptCreateHash(g_hAlgSHA256, &ps->hPiece, ps->objPiece, g_dwObjLenSHA, NULL, 0, 0) == 0;
+}
+
+static void PieceFeed(PIECE_STATE* ps, const BYTE* p, DWORD n)
+{
+	while (n > 0 && !ps->bFailed) {
+		DWORD take = ps->dwPieceSize - ps->dwPieceLen;
+		if (take > n) take = n;
+
+		if (BCryptHashData(ps->hPiece, (PUCHAR)p, take, 0) != 0) { ps->bFailed = TRUE; break; }
+		ps->dwPieceLen += take;
+		if (ps->dwPieceLen == ps->dwPieceSize && !PieceEmit(ps)) { ps->bFailed = TRUE; break; }
+
+		p += take; n -= take;
+	}
+}
+
+static BOOL PieceEnd(PIECE_STATE* ps, BOOL ok)
+{
+	if (ok && !ps->bFailed && ps->dwPieceLen > 0) {
+		if (!PieceEmit(ps)) ps->bFailed = TRUE;
+	}
+	if (ps->hPiece) { BCryptDestroyHash(ps->hPiece); ps->hPiece = NULL; }
+	if (ps->objPiece) { HeapFree(GetProcessHeap(), 0, ps->objPiece); ps->objPiece = NULL; }
+
+	PIECE_LIST_HEADER h;
+	ZeroMemory(&h, sizeof(h));
+	h.dwMagic = PIECE_LIST_MAGIC;
+	h.wVersion = 1;
+	h.wDigestLen = 32;
+	h.dwPieceSize = ps->dwPieceSize;
+	h.ullFileSize = ps->ullFileSize;
+	h.ullCount = ps->ullCount;
+
+	return SidecarClose(&ps->out, ok && !ps->bFailed, &h, sizeof(h));
+}
+
+// 读满 cb 字节（遇 EOF 提前返回）；返回 FALSE 表示 I/O 错误
+static BOOL ReadFull(HANDLE h, BYTE* p, DWORD cb, DWORD* pGot)
+{
+	DWORD got = 0;
+	while (got < cb) {
+		DWORD r = 0;
+		if (!ReadFile(h, p + got, cb - got, &r, NULL)) { *pGot = got; return FALSE; }
+		if (r == 0) break;
+		got += r;
+	}
+	*pGot = got;
+	return TRUE;
+}
+
+// ---------------- 限速（令牌桶）与后台优先级 ----------------
+// 所有批量读取都经 ThrottledRead（整段读取用 ThrottledReadFull）：先按全局桶和所在卷的桶预扣，
+// 读完按实际字节退差。直接用 ReadFile 的只剩本工具自己的旁路文件（清单、分片列表）
+// 和续算尾块指纹（≤ RESUME_TAIL_BYTES）。
+// 桶允许欠账，欠账未还清前后续读取等待；限速值可在批次进行中随时修改。
+#define MAX_IO_BUCKETS 32
+static const DWORD THROTTLE_MIN_CHUNK = 64 * 1024;
+static const DWORD THROTTLE_MAX_SLEEP_MS = 100;   // 睡眠分段，便于响应取消与限速调整
+
+typedef struct {
+	DWORD dwVolume;                // 卷序列号；全局桶不用
+	ULONGLONG ullRate;             // 字节/秒，0 = 不限
+	double tokens;                 // 可为负（欠账）
+	ULONGLONG ullLastTick;
+} IO_BUCKET;
+
+static CRITICAL_SECTION g_csThrottle;
+static IO_BUCKET g_BucketAll;
+static IO_BUCKET g_Buckets[MAX_IO_BUCKETS];
+static int g_nBuckets = 0;
+static volatile LONG g_lThrottleOn = 0;          // 任一桶有限速时为 1，不限速时读取不进锁
+
+static volatile LONG g_lBackground = 0;
+static __declspec(thread) LONG t_lBackground = 0; // 当前线程是否已进入后台模式
+
+// 调用方持有 g_csThrottle
+static IO_BUCKET* BucketFind_Locked(DWORD vol)
+{
+	for (int i = 0; i < g_nBuckets; i++) {
+		if (g_Buckets[i].dwVolume == vol) return &g_Buckets[i];
+	}
+	return NULL;
+}
+
+static void BucketRefill(IO_BUCKET* b, ULONGLONG now)
+{
+	if (!b->ullRate) return;
+	double cap = (double)b->ullRate / 4; // 最多攒 250ms 的额度
+	if (cap < THROTTLE_MIN_CHUNK) cap = THROTTLE_MIN_CHUNK;
+
+	b->tokens += (double)b->ullRate * (double)(now - b->ullLastTick) / 1000.0;
+	if (b->tokens > cap) b->tokens = cap;
+	b->ullLastTick = now;
+}
+
+static void BucketSetRate(IO_BUCKET* b, ULONGLONG rate)
+{
+	b->ullRate = rate;
+	b->tokens = 0;
+	b->ullLastTick = NowTick64();
+}
+
+static void ThrottleRecalc_Locked(void)
+{
+	LONG on = (g_BucketAll.ullRate != 0);
+	for (int i = 0; i < g_nBuckets && !on; i++) on = (g_Buckets[i].ullRate != 0);
+	InterlockedExchange(&g_lThrottleOn, on);
+}
+
+// 按全局/卷限速预扣；返回本次允许读取的字节数（限速时切小，避免一次读 8MB 造成突发）
+static DWORD ThrottleAcquire(DWORD vol, DWORD want)
+{
+	for (;;) {
+		if (InterlockedCompareExchange(&g_lCancelAll, 0, 0) != 0) return want;
+
+		ULONGLONG now = NowTick64();
+		ULONGLONG minRate = 0;
+		double owe = 0;
+
+		EnterCriticalSection(&g_csThrottle);
+		IO_BUCKET* bs[2] = { &g_BucketAll, BucketFind_Locked(vol) };
+		for (int i = 0; i < 2; i++) {
+			IO_BUCKET* b = bs[i];
+			if (!b || !b->ullRate) continue;
+			BucketRefill(b, now);
+			if (!minRate || b->ullRate < minRate) minRate = b->ullRate;
+			if (b->tokens < 0 && -b->tokens * 1000.0 / (double)b->ullRate > owe) owe = -b->tokens * 1000.0 / (double)b->ullRate;
+		}
+
+		if (owe < 1.0) {
+			if (minRate) {
+				// 每次最多读约 1/8 秒的量，按 64KB 取整（无缓冲读要求扇区对齐）
+				ULONGLONG chunk = (minRate / 8) & ~(ULONGLONG)(THROTTLE_MIN_CHUNK - 1);
+				if (chunk < THROTTLE_MIN_CHUNK) chunk = THROTTLE_MIN_CHUNK;
+				if (want > chunk) want = (DWORD)chunk;
+			}
+			for (int i = 0; i < 2; i++) {
+				if (bs[i] && bs[i]->ullRate) bs[i]->tokens -= want;
+			}
+			LeaveCriticalSection(&g_csThrottle);
+			return want;
+		}
+		LeaveCriticalSection(&g_csThrottle);
+
+		Sleep(owe > THROTTLE_MAX_SLEEP_MS ? THROTTLE_MAX_SLEEP_MS : (DWORD)owe);
+	}
+}
+
+// 读得比预扣少（EOF/出错）时退回差额
+static void ThrottleRefund(DWORD vol, DWORD unused)
+{
+	if (!unused) return;
+	EnterCriticalSection(&g_csThrottle);
+	IO_BUCKET* bs[2] = { &g_BucketAll, BucketFind_Locked(vol) };
+	for (int i = 0; i < 2; i++) {
+		if (bs[i] && bs[i]->ullRate) bs[i]->tokens += unused;
+	}
+	LeaveCriticalSection(&g_csThrottle);
+}
+
+// 后台模式同时降低本线程的 CPU 与 I/O 优先级；按全局开关在每次读取前同步，
+// 所以批次进行中切换也会在下一块生效
+static void BackgroundSync(void)
+{
+	LONG want = InterlockedCompareExchange(&g_lBackground, 0, 0);
+	if (want == t_lBackground) return;
+	if (SetThreadPriority(GetCurrentThread(), want ? THREAD_MODE_BACKGROUND_BEGIN : THREAD_MODE_BACKGROUND_END)) {
+		t_lBackground = want;
+	}
+}
+
+// 线程池回调返回前调用，线程不能带着后台模式回到池里
+static void BackgroundLeave(void)
+{
+	if (t_lBackground && SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END)) t_lBackground = 0;
+}
+
+static BOOL ThrottledRead(HANDLE h, BYTE* p, DWORD cb, DWORD* pGot, DWORD vol)
+{
+	BackgroundSync();
+	if (InterlockedCompareExchange(&g_lThrottleOn, 0, 0) == 0) return ReadFile(h, p, cb, pGot, NULL);
+
+	DWORD want = ThrottleAcquire(vol, cb);
+	*pGot = 0;
+	BOOL ok = ReadFile(h, p, want, pGot, NULL);
+	ThrottleRefund(vol, want - *pGot);
+	return ok;
+}
+
+// ReadFull 的限速版：限速时 ThrottledRead 会切小，循环读满 cb 字节（遇 EOF 提前返回）
+static BOOL ThrottledReadFull(HANDLE h, BYTE* p, DWORD cb, DWORD* pGot, DWORD vol)
+{
+	DWORD got = 0;
+	while (got < cb) {
+		DWORD r = 0;
+		if (!ThrottledRead(h, p + got, cb - got, &r, vol)) { *pGot = got; return FALSE; }
+		if (r == 0) break;
+		got += r;
+	}
+	*pGot = got;
+	return TRUE;
+}
+
+static DWORD VolumeOfHandle(HANDLE h)
+{
+	DWORD vol = 0;
+	ULONGLONG id = 0;
+	return GetFileIdentity(h, &vol, &id) ? vol : 0;
+}
+
+// ---------------- 稀疏文件：只读已分配区，空洞直接补零 ----------------
+// FSCTL_QUERY_ALLOCATED_RANGES 分批查询；空洞从共享零缓冲喂给各消费者，摘要与全量读取一致。
+#define SPARSE_MAX_RANGES 64
+static const DWORD SPARSE_ZERO_SIZE = 1024 * 1024;
+
+static BYTE* g_pZeroBuf = NULL;                 // 只读，所有线程共享
+static volatile LONGLONG g_llSparseBytesAll = 0; // 本批次补零（未读盘）的字节数
+
+typedef struct {
+	FILE_ALLOCATED_RANGE_BUFFER r[SPARSE_MAX_RANGES];
+	int n, i;
+	ULONGLONG ullEnd;          // 打开时的文件大小；之后增长的部分按普通读取
+	ULONGLONG ullQueried;      // 已查询到的位置
+	BOOL bFailed;              // 查询失败（文件系统不支持等）：退回普通读取
+} SPARSE_MAP;
+
+static BOOL SparseBegin(SPARSE_MAP* m, HANDLE h, ULONGLONG fileSize)
+{
+	BY_HANDLE_FILE_INFORMATION bhi;
+	ZeroMemory(m, sizeof(*m));
+	m->ullEnd = fileSize;
+	return g_pZeroBuf && fileSize > 0 &&
+		GetFileInformationByHandle(h, &bhi) && (bhi.dwFileAttributes & FILE_ATTRIBUTE_SPARSE_FILE);
+}
+
+// 返回 pos 处空洞的长度；0 = pos 在已分配区，*pDataLen 为该区剩余长度（-1 = 不再限制）
+static ULONGLONG SparseAt(SPARSE_MAP* m, HANDLE h, ULONGLONG pos, ULONGLONG* pDataLen)
+{
+	*pDataLen = (ULONGLONG)-1;
+	if (m->bFailed || pos >= m->ullEnd) return 0;
+
+	for (;;) {
+		while (m->i < m->n && (ULONGLONG)(m->r[m->i].FileOffset.QuadPart + m->r[m->i].Length.QuadPart) <= pos) m->i++;
+		if (m->i < m->n) {
+			ULONGLONG off = (ULONGLONG)m->r[m->i].FileOffset.QuadPart;
+			if (pos < off) return off - pos;
+			*pDataLen = off + (ULONGLONG)m->r[m->i].Length.QuadPart - pos;
+			return 0;
+		}
+		if (m->ullQueried >= m->ullEnd) return m->ullEnd - pos; // 之后没有已分配区
+
+		FILE_ALLOCATED_RANGE_BUFFER q;
+		q.FileOffset.QuadPart = (LONGLONG)((pos > m->ullQueried) ? pos : m->ullQueried);
+		q.Length.QuadPart = (LONGLONG)(m->ullEnd - (ULONGLONG)q.FileOffset.QuadPart);
+
+		DWORD cb = 0;
+		BOOL ok = DeviceIoControl(h, FSCTL_QUERY_ALLOCATED_RANGES, &q, sizeof(q), m->r, sizeof(m->r), &cb, NULL);
+		m->n = (int)(cb / sizeof(m->r[0]));
+		m->i = 0;
+		if (ok) {
+			m->ullQueried = m->ullEnd;
+		}
+		else if (GetLastError() == ERROR_MORE_DATA && m->n > 0) {
+			m->ullQueried = (ULONGLONG)(m->r[m->n - 1].FileOffset.QuadPart + m->r[m->n - 1].Length.QuadPart);
+		}
+		else {
+			m->bFailed = TRUE;
+			return 0;
+		}
+	}
+}
+
+// ---------------- 多算法分核（一读多哈希） ----------------
+// 大文件同时有两路以上的哈希（MD5、SHA-256、分块清单的逐块 SHA-256）时，读线程只负责读盘，
+// 每一路在车道线程池里各占一个线程，按顺序消费带引用计数的环形缓冲；
+// 单文件耗时降为最慢的那一路，文件仍只读一遍。
+#define FAN_LANES 3
+#define FAN_SLOTS 3
+static const ULONGLONG FAN_MIN_FILE_SIZE = 64ull * 1024 * 1024;
+
+typedef struct {
+	const BYTE* p;             // 数据所在：槽缓冲或共享零缓冲
+	DWORD n;                   // 0 = 结束标记
+	volatile LONG lRefs;       // 车道数 + 读线程本身；归零时槽位可复用
+} FAN_SLOT;
+
+struct FAN_OUT;
+
+typedef struct {
+	struct FAN_OUT* f;
+	BCRYPT_HASH_HANDLE h;
+	CDC_STATE* cdc;            // 非空 = 分块车道：找切点并逐块哈希，不用 h
+	HANDLE hReady;             // 信号量：已发布、本车道尚未消费的槽数
+	PTP_WORK work;
+} FAN_LANE;
+
+typedef struct FAN_OUT {
+	BYTE* mem[FAN_SLOTS];      // mem[0] 借用读线程的 ioBuf，其余切自 region
+	BYTE* region;
+	DWORD cbRegion;
+	FAN_SLOT slot[FAN_SLOTS];
+	HANDLE hFree;              // 信号量：空闲槽数
+	FAN_LANE lane[FAN_LANES];
+	int nLanes;
+	int iNext;                 // 下一个要填的槽
+	int iHeld;                 // 读线程仍持有（调用方还在用）的槽，-1 = 无
+	BOOL bReserved;            // iNext 已占到空闲名额
+	volatile LONG lFailed;
+} FAN_OUT;
+
+static void FanRelease(FAN_OUT* f, int i)
+{
+	if (InterlockedDecrement(&f->slot[i].lRefs) == 0) ReleaseSemaphore(f->hFree, 1, NULL);
+}
+
+static VOID CALLBACK FanLaneCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
+{
+	(void)Instance; (void)Work;
+	FAN_LANE* ln = (FAN_LANE*)Context;
+	FAN_OUT* f = ln->f;
+
+	for (int i = 0;; i = (i + 1) % FAN_SLOTS) {
+		WaitForSingleObject(ln->hReady, INFINITE);
+		FAN_SLOT* s = &f->slot[i];
+		DWORD n = s->n;
+		if (n) BackgroundSync(); // 大文件的哈希 CPU 都在车道上，后台模式要跟着降
+		if (n && ln->cdc) {
+			CdcFeed(ln->cdc, s->p, n); // 清单失败只记在 cdc->bFailed，不影响整文件哈希
+		}
+		else if (n && InterlockedCompareExchange(&f->lFailed, 0, 0) == 0 &&
+			BCryptHashData(ln->h, (PUCHAR)s->p, n, 0) != 0) {
+			InterlockedExchange(&f->lFailed, 1);
+		}
+		FanRelease(f, i);
+		if (!n) break;
+	}
+	BackgroundLeave();
+}
+
+static BOOL FanEnd(FAN_OUT* f, BOOL bWait);
+
+// 至少两路哈希、文件足够大、还有空闲核且内存预算够时才启用；否则返回 FALSE，由读线程串行哈希。
+// 返回 TRUE 时 cdc（若非空）改由车道喂数据，读线程不要再调用 CdcFeed
+static BOOL FanBegin(FAN_OUT* f, BYTE* ioBuf, DWORD cbBuf, ULONGLONG fileSize,
+	BCRYPT_HASH_HANDLE hMd5, BCRYPT_HASH_HANDLE hSha, CDC_STATE* cdc)
+{
+	int n = 0;
+	ZeroMemory(f, sizeof(*f));
+	f->iHeld = -1;
+	if (hMd5) f->lane[n++].h = hMd5;
+	if (hSha) f->lane[n++].h = hSha;
+	if (cdc) f->lane[n++].cdc = cdc;
+
+	if (!g_lanePool || n < 2 || fileSize < FAN_MIN_FILE_SIZE) goto fail;
+	if (InterlockedCompareExchange(&g_lRunningCount, 0, 0) * (n + 1) > (LONG)g_dwCpuCount) goto fail;
+
+	// 已持有读缓冲，不能再等预算
+	f->region = MemAcquire((FAN_SLOTS - 1) * cbBuf, (FAN_SLOTS - 1) * cbBuf, &f->cbRegion, FALSE, NULL);
+	if (!f->region) goto fail;
+	f->mem[0] = ioBuf;
+	for (int i = 1; i < FAN_SLOTS; i++) f->mem[i] = f->region + (i - 1) * cbBuf;
+	f->hFree = CreateSemaphoreW(NULL, FAN_SLOTS, FAN_SLOTS, NULL);
+	if (!f->hFree) goto fail;
+
+	for (int i = 0; i < n; i++) {
+		FAN_LANE* ln = &f->lane[i];
+		ln->f = f;
+		ln->hReady = CreateSemaphoreW(NULL, 0, FAN_SLOTS, NULL);
+		if (!ln->hReady) goto fail;
+		ln->work = CreateThreadpoolWork(FanLaneCallback, ln, &g_laneEnv);
+		if (!ln->work) goto fail;
+	}
+	f->nLanes = n;
+	for (int i = 0; i < n; i++) SubmitThreadpoolWork(f->lane[i].work);
+	return TRUE;
+
+fail:
+	FanEnd(f, FALSE);
+	return FALSE;
+}
+
+// 释放上一次交给调用方的槽，并占一个空闲槽用于本次读取
+static BYTE* FanAcquire(FAN_OUT* f)
+{
+	if (f->iHeld >= 0) {
+		FanRelease(f, f->iHeld);
+		f->iHeld = -1;
+	}
+	if (!f->bReserved) {
+		WaitForSingleObject(f->hFree, INFINITE); // 车道总在前进，等待有界
+		f->bReserved = TRUE;
+	}
+	return f->mem[f->iNext];
+}
+
+// 把本次数据交给所有车道；读线程继续持有到下一次 FanAcquire，供分块/分片/归档解析使用
+static void FanPublish(FAN_OUT* f, const BYTE* p, DWORD n, BOOL bHold)
+{
+	FAN_SLOT* s = &f->slot[f->iNext];
+	s->p = p;
+	s->n = n;
+	s->lRefs = f->nLanes + (bHold ? 1 : 0);
+	for (int i = 0; i < f->nLanes; i++) ReleaseSemaphore(f->lane[i].hReady, 1, NULL);
+
+	if (bHold) f->iHeld = f->iNext;
+	f->iNext = (f->iNext + 1) % FAN_SLOTS;
+	f->bReserved = FALSE;
+}
+
+// bWait=TRUE：发结束标记并等车道把已发布的数据全部哈希完；返回车道是否全部成功
+static BOOL FanEnd(FAN_OUT* f, BOOL bWait)
+{
+	if (bWait && f->nLanes) {
+		FanAcquire(f);
+		FanPublish(f, NULL, 0, FALSE);
+		for (int i = 0; i < f->nLanes; i++) WaitForThreadpoolWorkCallbacks(f->lane[i].work, FALSE);
+	}
+	for (int i = 0; i < FAN_LANES; i++) {
+		if (f->lane[i].work) CloseThreadpoolWork(f->lane[i].work);
+		if (f->lane[i].hReady) CloseHandle(f->lane[i].hReady);
+	}
+	if (f->hFree) CloseHandle(f->hFree);
+	MemRelease(f->region, f->cbRegion);
+
+	BOOL ok = (InterlockedCompareExchange(&f->lFailed, 0, 0) == 0);
+	ZeroMemory(f, sizeof(*f));
+	f->iHeld = -1;
+	return ok;
+}
+
+// ---------------- 单遍读取（整文件哈希 + 分块 + 分片 + 复制 + 进度） ----------------
+struct COPY_SINK;
+static BYTE* CopyNextBuffer(struct COPY_SINK* c);
+static void CopyWrite(struct COPY_SINK* c, const BYTE* p, DWORD n);
+
+typedef struct {
+	FILE_HASH_TASK* t;
+	HANDLE hFile;
+	DWORD  dwVolume;    // 限速按卷分桶
+	BYTE*  ioBuf;       // 自有读缓冲
+	BYTE*  buf;         // 本次数据所在：ioBuf、复制缓冲之一或共享零缓冲
+	DWORD  cbBuf;
+	SPARSE_MAP* sparse; // NULL = 非稀疏文件
+	ULONGLONG ullSparse;
+
+	ULONGLONG done;
+	DWORD  lastUi;
+
+	BCRYPT_HASH_HANDLE hMd5, hSha;
+	FAN_OUT*     fan;   // 非空时 MD5/SHA-256（及分块）交给车道线程，buf 在环形槽间轮换
+	CDC_STATE*   cdc;   // NULL = 不输出分块清单，或已交给分块车道
+	PIECE_STATE* pcs;   // NULL = 不输出分片哈希
+	struct COPY_SINK* copy; // NULL = 不复制；非空时 buf 在两个缓冲间轮换
+
+	BOOL bError;        // I/O、哈希失败或取消
+} READ_PASS;
+
+// 读取下一块并喂给所有消费者，同时推进进度；
+// 返回本次字节数，0 = EOF / 出错 / 取消（后两者 bError=TRUE）
+static DWORD ReadPassNext(READ_PASS* rp)
+{
+	FILE_HASH_TASK* t = rp->t;
+	if (rp->bError) return 0;
+
+	if (InterlockedCompareExchange(&g_lCancelAll, 0, 0) != 0 || InterlockedCompareExchange(&t->bCanceled, 0, 0) != 0) {
+		InterlockedExchange(&t->bCanceled, 1);
+		rp->bError = TRUE;
+		return 0;
+	}
+
+	if (rp->fan) rp->buf = FanAcquire(rp->fan);
+	else rp->buf = rp->copy ? CopyNextBuffer(rp->copy) : rp->ioBuf;
+
+	DWORD dwRead = 0;
+	DWORD want = rp->cbBuf;
+	ULONGLONG hole = 0, dataLen = 0;
+	if (rp->sparse) {
+		hole = SparseAt(rp->sparse, rp->hFile, rp->done, &dataLen);
+		if (dataLen < want) want = (DWORD)dataLen; // 读到已分配区末尾为止
+	}
+
+	if (hole) {
+		// 空洞：不读盘，文件指针跳到空洞之后
+		dwRead = (hole < SPARSE_ZERO_SIZE) ? (DWORD)hole : SPARSE_ZERO_SIZE;
+		LARGE_INTEGER li; li.QuadPart = (LONGLONG)(rp->done + dwRead);
+		if (!SetFilePointerEx(rp->hFile, li, NULL, FILE_BEGIN)) { rp->bError = TRUE; return 0; }
+		rp->buf = g_pZeroBuf;
+		rp->ullSparse += dwRead;
+		InterlockedAdd64(&g_llSparseBytesAll, (LONGLONG)dwRead);
+	}
+	else {
+		BOOL br = ThrottledRead(rp->hFile, rp->buf, want, &dwRead, rp->dwVolume);
+		if (!br) { rp->bError = TRUE; return 0; }
+		if (dwRead == 0) return 0;
+	}
+
+	if (rp->fan) {
+		FanPublish(rp->fan, rp->buf, dwRead, TRUE);
+	}
+	else {
+		if (rp->hMd5 && BCryptHashData(rp->hMd5, (PUCHAR)rp->buf, dwRead, 0) != 0) { rp->bError = TRUE; return 0; }
+		if (rp->hSha && BCryptHashData(rp->hSha, (PUCHAR)rp->buf, dwRead, 0) != 0) { rp->bError = TRUE; return 0; }
+	}
+	if (rp->cdc) CdcFeed(rp->cdc, rp->buf, dwRead);
+	if (rp->pcs) PieceFeed(rp->pcs, rp->buf, dwRead);
+	if (rp->copy) CopyWrite(rp->copy, rp->buf, dwRead);
+
+	rp->done += dwRead;
+	InterlockedExchange64(&t->llDoneBytes, (LONGLONG)rp->done);
+	InterlockedAdd64(&g_llDoneBytesAll, (LONGLONG)dwRead);
+
+	DWORD now = GetTickCount();
+	if (now - rp->lastUi >= UI_THROTTLE_MS_WORKER) {
+		rp->lastUi = now;
+
+		LONG pct = 0;
+		ULONGLONG fs = t->ullFileSize;
+		if (fs > 0) {
+			double dp = (double)rp->done * 100.0 / (double)fs;
+			if (dp < 0) dp = 0;
+			if (dp > 100) dp = 100;
+			pct = (LONG)(dp + 0.5);
+		}
+
+		LONG lastPct = InterlockedCompareExchange(&t->lLastUiPctNotified, 0, 0);
+		if (pct >= lastPct + 1 || pct == 100 || lastPct < 0) {
+			InterlockedExchange(&t->lLastUiPctNotified, pct);
+			InterlockedExchange(&g_bTextDirty, 1);
+		}
+		RequestUiUpdate();
+	}
+	return dwRead;
+}
+
+
+// ---------------- 归档成员流式哈希（zip / tar / tar.gz / gz） ----------------
+// 不解压落盘：tar/gz 在整文件哈希的同一遍读取中边解压边解析；
+// zip 读中央目录后按成员并行提交到线程池，各成员用独立句柄读取。
+#define ARC_NONE 0
+#define ARC_ZIP  1
+#define ARC_TAR  2
+#define ARC_TGZ  3
+#define ARC_GZ   4
+
+typedef struct ARCHIVE_MEMBER {
+	WCHAR szName[MAX_PATH];
+	ULONGLONG ullSize;                 // 已哈希的解压后字节数
+	ULONGLONG ullExpectSize;           // 目录/头部声明的大小（gz 未知为 0）
+	DWORD dwCrc;                       // zip：中央目录声明的 CRC-32
+	WCHAR szMD5Value[33];
+	WCHAR szSHA256Value[65];
+	volatile LONG bFinished;
+	BOOL  bSuccess;
+
+	// zip 专用：成员回调按这些字段独立读取
+	FILE_HASH_TASK* pTask;
+	ULONGLONG ullLocalOffset;
+	ULONGLONG ullCompSize;
+	WORD  wMethod;
+	WORD  wFlags;
+} ARCHIVE_MEMBER;
+
+static const LONG  ARC_MAX_MEMBERS = 65536;
+static const LONG  ARC_TEXT_MAX_MEMBERS = 1000; // 文本里每个归档最多列出的成员数
+static const DWORD ARC_MEMBER_BUF_SIZE = 1024 * 1024;
+static const DWORD ARC_ZIP_MAX_CD = 256 * 1024 * 1024;
+static const DWORD ARC_TAR_MAX_META = 64 * 1024;
+
+static BOOL EndsWithI(const WCHAR* s, const WCHAR* suffix)
+{
+	size_t n = wcslen(s), m = wcslen(suffix);
+	return n >= m && _wcsicmp(s + n - m, suffix) == 0;
+}
+
+static int ArchiveKindFromPath(const WCHAR* path)
+{
+	if (EndsWithI(path, L".zip")) return ARC_ZIP;
+	if (EndsWithI(path, L".tar")) return ARC_TAR;
+	if (EndsWithI(path, L".tar.gz") || EndsWithI(path, L".tgz")) return ARC_TGZ;
+	if (EndsWithI(path, L".gz")) return ARC_GZ;
+	return ARC_NONE;
+}
+
+static WORD Le16(const BYTE* p) { return (WORD)(p[0] | (p[1] << 8)); }
+static DWORD Le32(const BYTE* p) { return (DWORD)p[0] | ((DWORD)p[1] << 8) | ((DWORD)p[2] << 16) | ((DWORD)p[3] << 24); }
+static ULONGLONG Le64(const BYTE* p) { return (ULONGLONG)Le32(p) | ((ULONGLONG)Le32(p + 4) << 32); }
+
+// CRC-32（zip / gzip 共用，反射多项式 0xEDB88320），按 8 字节切片查表
+static DWORD g_Crc32[8][256];
+
+static void Crc32Init(void)
+{
+	for (DWORD i = 0; i < 256; i++) {
+		DWORD c = i;
+		for (int k = 0; k < 8; k++) c = (c >> 1) ^ (0xEDB88320u & (0u - (c & 1)));
+		g_Crc32[0][i] = c;
+	}
+	for (DWORD i = 0; i < 256; i++) {
+		for (int s = 1; s < 8; s++) g_Crc32[s][i] = (g_Crc32[s - 1][i] >> 8) ^ g_Crc32[0][g_Crc32[s - 1][i] & 0xFF];
+	}
+}
+
+// crc 传上一次的返回值，初值 0
+static DWORD Crc32Update(DWORD crc, const BYTE* p, DWORD n)
+{
+	crc = ~crc;
+	while (n >= 8) {
+		DWORD a = crc ^ Le32(p), b = Le32(p + 4);
+		crc = g_Crc32[7][a & 0xFF] ^ g_Crc32[6][(a >> 8) & 0xFF] ^ g_Crc32[5][(a >> 16) & 0xFF] ^ g_Crc32[4][a >> 24] ^
+			g_Crc32[3][b & 0xFF] ^ g_Crc32[2][(b >> 8) & 0xFF] ^ g_Crc32[1][(b >> 16) & 0xFF] ^ g_Crc32[0][b >> 24];
+		p += 8; n -= 8;
+	}
+	while (n--) crc = (crc >> 8) ^ g_Crc32[0][(crc ^ *p++) & 0xFF];
+	return ~crc;
+}
+
+// 成员名（多字节）转 UTF-16；utf8=FALSE 时按 OEM 代码页（zip 未置 bit 11）
+static void ArchiveNameToWide(const char* name, int len, BOOL utf8, WCHAR* out, size_t cch)
+{
+	UINT cp = utf8 ? CP_UTF8 : CP_OEMCP;
+	DWORD flags = utf8 ? MB_ERR_INVALID_CHARS : 0;
+	out[0] = L'\0';
+	if (len <= 0) return;
+
+	int need = MultiByteToWideChar(cp, flags, name, len, NULL, 0);
+	if (need <= 0 && utf8) {
+		cp = CP_ACP; flags = 0;
+		need = MultiByteToWideChar(cp, flags, name, len, NULL, 0);
+	}
+	if (need <= 0) return;
+
+	WCHAR* tmp = (WCHAR*)HeapAlloc(GetProcessHeap(), 0, ((size_t)need + 1) * sizeof(WCHAR));
+	if (!tmp) return;
+	MultiByteToWideChar(cp, flags, name, len, tmp, need);
+	tmp[need] = L'\0';
+	StringCchCopyW(out, cch, tmp); // 过长时截断
+	HeapFree(GetProcessHeap(), 0, tmp);
+}
+
+// 追加 n 个成员行；返回首个下标，-1 = 超出上限或内存不足。
+// 只有任务自己的 worker 会增长数组，但文本构建会读，所以在 g_csTasks 内重分配。
+static LONG ArchiveAddMembers(FILE_HASH_TASK* t, LONG n)
+{
+	LONG first = -1;
+	EnterCriticalSection(&g_csTasks);
+	if (n > 0 && t->nMembers + n <= ARC_MAX_MEMBERS) {
+		if (t->nMembers + n > t->nMembersCap) {
+			LONG cap = t->nMembersCap ? t->nMembersCap : 16;
+			while (cap < t->nMembers + n) cap *= 2;
+			if (cap > ARC_MAX_MEMBERS) cap = ARC_MAX_MEMBERS;
+
+			SIZE_T cb = (SIZE_T)cap * sizeof(ARCHIVE_MEMBER);
+			ARCHIVE_MEMBER* p = t->pMembers
+				? (ARCHIVE_MEMBER*)HeapReAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, t->pMembers, cb)
+				: (ARCHIVE_MEMBER*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, cb);
+			if (p) {
+				t->pMembers = p;
+				t->nMembersCap = cap;
+			}
+		}
+		if (t->nMembers + n <= t->nMembersCap) {
+			first = t->nMembers;
+			t->nMembers += n;
+		}
+	}
+	LeaveCriticalSection(&g_csTasks);
+	return first;
+}
+
+// 调用方持有 g_csTasks
+static void ArchiveFreeMembers_Locked(FILE_HASH_TASK* t)
+{
+	if (t->pMembers) HeapFree(GetProcessHeap(), 0, t->pMembers);
+	t->pMembers = NULL;
+	t->nMembers = 0;
+	t->nMembersCap = 0;
+}
+
+// ---- 成员哈希上下文 ----
+typedef struct {
+	BOOL bMD5, bSHA;
+	BCRYPT_HASH_HANDLE hMd5, hSha;
+	PUCHAR objMd5, objSha;
+	ULONGLONG ullBytes;
+	BOOL bCrc;                 // 同时累计 CRC-32（zip 成员与目录声明的比对）
+	DWORD dwCrc;
+	BOOL bFailed;
+} MEMBER_HASH;
+
+static BOOL MemberHashInit(MEMBER_HASH* mh, BOOL md5, BOOL sha)
+{
+	ZeroMemory(mh, sizeof(*mh));
+	mh->bMD5 = md5;
+	mh->bSHA = sha;
+	if (md5 && !(mh->objMd5 = (PUCHAR)HeapAlloc(GetProcessHeap(), 0, g_dwObjLenMD5))) return FALSE;
+	if (sha && !(mh->objSha = (PUCHAR)HeapAlloc(GetProcessHeap(), 0, g_dwObjLenSHA))) return FALSE;
+	return TRUE;
+}
+
+static BOOL MemberHashBegin(MEMBER_HASH* mh)
+{
+	mh->ullBytes = 0;
+	mh->dwCrc = 0;
+	mh->bFailed = FALSE;
+	if (mh->bMD5 && BCryptCreateHash(g_hAlgMD5, &mh->hMd5, mh->objMd5, g_dwObjLenMD5, NULL, 0, 0) != 0) mh->bFailed = TRUE;
+	if (mh->bSHA && BCryptCreateHash(g_hAlgSHA256, &mh->hSha, mh->objSha, g_dwObjLenSHA, NULL, 0, 0) != 0) mh->bFailed = TRUE;
+	return !mh->bFailed;
+}
+
+static void MemberHashFeed(MEMBER_HASH* mh, const BYTE* p, DWORD n)
+{
+	if (mh->bFailed || n == 0) return;
+	if (mh->hMd5 && BCryptHashData(mh->hMd5, (PUCHAR)p, n, 0) != 0) mh->bFailed = TRUE;
+	if (mh->hSha && BCryptHashData(mh->hSha, (PUCHAR)p, n, 0) != 0) mh->bFailed = TRUE;
+	if (mh->bCrc) mh->dwCrc = Crc32Update(mh->dwCrc, p, n);
+	mh->ullBytes += n;
+}
+
+// ok=FALSE：成员损坏、截断或取消，只收尾不出结果
+static void MemberHashEnd(MEMBER_HASH* mh, ARCHIVE_MEMBER* m, BOOL ok)
+{
+	BYTE out[32];
+	ok = ok && !mh->bFailed;
+
+	if (mh->hMd5) {
+		if (ok && BCryptFinishHash(mh->hMd5, out, g_dwHashLenMD5, 0) == 0) BinToHexUpper(out, g_dwHashLenMD5, m->szMD5Value, _countof(m->szMD5Value));
+		else ok = FALSE;
+		BCryptDestroyHash(mh->hMd5);
+		mh->hMd5 = NULL;
+	}
+	if (mh->hSha) {
+		if (ok && BCryptFinishHash(mh->hSha, out, g_dwHashLenSHA, 0) == 0) BinToHexUpper(out, g_dwHashLenSHA, m->szSHA256Value, _countof(m->szSHA256Value));
+		else ok = FALSE;
+		BCryptDestroyHash(mh->hSha);
+		mh->hSha = NULL;
+	}
+
+	m->ullSize = mh->ullBytes;
+	m->bSuccess = ok;
+	InterlockedExchange(&m->bFinished, 1);
+	InterlockedExchange(&g_bTextDirty, 1);
+}
+
+static void MemberHashFree(MEMBER_HASH* mh)
+{
+	if (mh->hMd5) BCryptDestroyHash(mh->hMd5);
+	if (mh->hSha) BCryptDestroyHash(mh->hSha);
+	if (mh->objMd5) HeapFree(GetProcessHeap(), 0, mh->objMd5);
+	if (mh->objSha) HeapFree(GetProcessHeap(), 0, mh->objSha);
+	ZeroMemory(mh, sizeof(*mh));
+}
+
+// ---- raw deflate 流式解码（RFC 1951），输入按需拉取，输出经 64KB 环形窗口推送 ----
+typedef DWORD(*INFL_PULL)(void* ctx, const BYTE** pp);      // 返回 0 = 输入结束
+typedef BOOL(*INFL_PUSH)(void* ctx, const BYTE* p, DWORD n); // 返回 FALSE = 下游要求停止
+
+#define INFL_FAST_BITS 10
+#define INFL_WSIZE 65536
+
+typedef struct {
+	WORD fast[1 << INFL_FAST_BITS]; // (码长 << 12) | 符号；0 = 走慢速路径
+	WORD counts[16];
+	WORD symbols[288];
+} HUFF;
+
+typedef struct {
+	INFL_PULL pull; void* pullCtx;
+	const BYTE* in;
+	DWORD inLen;
+	BOOL  bInEof;
+	DWORD padBytes;       // 输入耗尽后补入的零字节数
+
+	uint32_t bitbuf;
+	int bitcnt;
+
+	BYTE* win;
+	ULONGLONG wpos, flushed;
+	INFL_PUSH push; void* pushCtx;
+
+	HUFF lit, dist;
+	BOOL bStopped, bError;
+} INFLATE;
+
+static const WORD kLenBase[29] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+static const BYTE kLenExtra[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+static const WORD kDistBase[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+static const BYTE kDistExtra[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+static const BYTE kClOrder[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
+
+static HUFF g_HuffFixedLit, g_HuffFixedDist;
+
+static BOOL HuffBuild(HUFF* h, const BYTE* lengths, int num)
+{
+	WORD offs[16];
+	ZeroMemory(h, sizeof(*h));
+
+	for (int i = 0; i < num; i++) h->counts[lengths[i]]++;
+	h->counts[0] = 0;
+
+	int left = 1;
+	for (int len = 1; len <= 15; len++) {
+		left <<= 1;
+		left -= h->counts[len];
+		if (left < 0) return FALSE; // 超额订阅
+	}
+
+	offs[1] = 0;
+	for (int len = 1; len < 15; len++) offs[len + 1] = (WORD)(offs[len] + h->counts[len]);
+	for (int i = 0; i < num; i++) {
+		if (lengths[i]) h->symbols[offs[lengths[i]]++] = (WORD)i;
+	}
+
+	// 短码查表：deflate 按位逆序存放 Huffman 码
+	int code = 0, k = 0;
+	for (int len = 1; len <= 15; len++) {
+		for (int c = 0; c < h->counts[len]; c++, k++, code++) {
+			if (len > INFL_FAST_BITS) continue;
+			int rev = 0;
+			for (int b = 0; b < len; b++) rev |= ((code >> b) & 1) << (len - 1 - b);
+			for (int fill = rev; fill < (1 << INFL_FAST_BITS); fill += (1 << len)) {
+				h->fast[fill] = (WORD)((len << 12) | h->symbols[k]);
+			}
+		}
+		code <<= 1;
+	}
+	return TRUE;
+}
+
+static void InflInitFixed(void)
+{
+	BYTE l[288];
+	int i = 0;
+	for (; i < 144; i++) l[i] = 8;
+	for (; i < 256; i++) l[i] = 9;
+	for (; i < 280; i++) l[i] = 7;
+	for (; i < 288; i++) l[i] = 8;
+	HuffBuild(&g_HuffFixedLit, l, 288);
+
+	for (i = 0; i < 30; i++) l[i] = 5;
+	HuffBuild(&g_HuffFixedDist, l, 30);
+}
+
+static BOOL InflInit(INFLATE* z, INFL_PULL pull, void* pullCtx, INFL_PUSH push, void* pushCtx)
+{
+	ZeroMemory(z, sizeof(*z));
+	z->pull = pull; z->pullCtx = pullCtx;
+	z->push = push; z->pushCtx = pushCtx;
+	z->win = (BYTE*)HeapAlloc(GetProcessHeap(), 0, INFL_WSIZE);
+	return z->win != NULL;
+}
+
+static void InflFree(INFLATE* z)
+{
+	if (z->win) HeapFree(GetProcessHeap(), 0, z->win);
+	z->win = NULL;
+}
+
+static BOOL InflNextByte(INFLATE* z, BYTE* b)
+{
+	if (z->inLen == 0 && !z->bInEof) {
+		z->inLen = z->pull(z->pullCtx, &z->in);
+		if (z->inLen == 0) z->bInEof = TRUE;
+	}
+	if (z->inLen == 0) { *b = 0; return FALSE; }
+	*b = *z->in++;
+	z->inLen--;
+	return TRUE;
+}
+
+// 不足时在末尾补零，便于查表；真正读穿输入时置 bError
+static void InflFill(INFLATE* z, int n)
+{
+	while (z->bitcnt < n) {
+		BYTE b;
+		if (!InflNextByte(z, &b) && ++z->padBytes > 4) z->bError = TRUE;
+		z->bitbuf |= (uint32_t)b << z->bitcnt;
+		z->bitcnt += 8;
+	}
+}
+
+static DWORD InflBits(INFLATE* z, int n)
+{
+	if (n == 0) return 0;
+	InflFill(z, n);
+	DWORD v = z->bitbuf & ((1u << n) - 1);
+	z->bitbuf >>= n;
+	z->bitcnt -= n;
+	return v;
+}
+
+// 位缓冲里剩下的整字节都是补零、且输入已尽
+static BOOL InflAtEnd(INFLATE* z)
+{
+	if (z->bitcnt >= 8) return (DWORD)z->bitcnt <= z->padBytes * 8;
+	if (z->inLen > 0) return FALSE;
+	if (!z->bInEof) {
+		z->inLen = z->pull(z->pullCtx, &z->in);
+		if (z->inLen == 0) z->bInEof = TRUE;
+	}
+	return z->inLen == 0;
+}
+
+static int HuffDecode(INFLATE* z, const HUFF* h)
+{
+	InflFill(z, INFL_FAST_BITS);
+	WORD e = h->fast[z->bitbuf & ((1 << INFL_FAST_BITS) - 1)];
+	if (e) {
+		int len = e >> 12;
+		z->bitbuf >>= len;
+		z->bitcnt -= len;
+		return e & 0x0FFF;
+	}
+
+	// 长码：规范 Huffman 逐位解码
+	int sum = 0, cur = 0, len = 0;
+	do {
+		cur = 2 * cur + (int)InflBits(z, 1);
+		if (++len > 15) return -1;
+		sum += h->counts[len];
+		cur -= h->counts[len];
+	} while (cur >= 0);
+	return h->symbols[sum + cur];
+}
+
+static void InflFlush(INFLATE* z)
+{
+	while (z->flushed < z->wpos && !z->bStopped) {
+		DWORD off = (DWORD)(z->flushed & (INFL_WSIZE - 1));
+		DWORD n = (DWORD)(z->wpos - z->flushed);
+		if (n > INFL_WSIZE - off) n = INFL_WSIZE - off;
+		if (!z->push(z->pushCtx, z->win + off, n)) z->bStopped = TRUE;
+		z->flushed += n;
+	}
+}
+
+// 未推送部分不超过半个窗口，另一半保留 32KB 历史供回溯
+static void InflPut(INFLATE* z, BYTE b)
+{
+	z->win[z->wpos & (INFL_WSIZE - 1)] = b;
+	if (++z->wpos - z->flushed >= INFL_WSIZE / 2) InflFlush(z);
+}
+
+static BOOL InflCodes(INFLATE* z, const HUFF* lit, const HUFF* dist)
+{
+	for (;;) {
+		if (z->bError || z->bStopped) return FALSE;
+
+		int sym = HuffDecode(z, lit);
+		if (sym < 0) { z->bError = TRUE; return FALSE; }
+		if (sym < 256) { InflPut(z, (BYTE)sym); continue; }
+		if (sym == 256) return TRUE;
+
+		sym -= 257;
+		if (sym >= 29) { z->bError = TRUE; return FALSE; }
+		DWORD len = kLenBase[sym] + InflBits(z, kLenExtra[sym]);
+
+		int ds = HuffDecode(z, dist);
+		if (ds < 0 || ds >= 30) { z->bError = TRUE; return FALSE; }
+		DWORD d = kDistBase[ds] + InflBits(z, kDistExtra[ds]);
+		if (d > z->wpos || d > 32768) { z->bError = TRUE; return FALSE; }
+
+		while (len--) InflPut(z, z->win[(z->wpos - d) & (INFL_WSIZE - 1)]);
+	}
+}
+
+static BOOL InflStored(INFLATE* z)
+{
+	InflBits(z, z->bitcnt & 7);
+	DWORD len = InflBits(z, 16);
+	DWORD nlen = InflBits(z, 16);
+	if ((len ^ 0xFFFF) != nlen) { z->bError = TRUE; return FALSE; }
+
+	while (len && z->bitcnt >= 8) { InflPut(z, (BYTE)InflBits(z, 8)); len--; }
+	while (len && !z->bStopped) {
+		BYTE b;
+		if (!InflNextByte(z, &b)) { z->bError = TRUE; return FALSE; }
+		InflPut(z, b);
+		len--;
+	}
+	return !z->bError;
+}
+
+static BOOL InflDynamic(INFLATE* z)
+{
+	BYTE lens[286 + 30];
+	BYTE cl[19];
+	HUFF clh;
+
+	DWORD hlit = InflBits(z, 5) + 257;
+	DWORD hdist = InflBits(z, 5) + 1;
+	DWORD hclen = InflBits(z, 4) + 4;
+	if (hlit > 286 || hdist > 30) { z->bError = TRUE; return FALSE; }
+
+	ZeroMemory(cl, sizeof(cl));
+	for (DWORD i = 0; i < hclen; i++) cl[kClOrder[i]] = (BYTE)InflBits(z, 3);
+	if (!HuffBuild(&clh, cl, 19)) { z->bError = TRUE; return FALSE; }
+
+	DWORD n = 0;
+	while (n < hlit + hdist) {
+		if (z->bError) return FALSE;
+		int sym = HuffDecode(z, &clh);
+		if (sym < 0) { z->bError = TRUE; return FALSE; }
+
+		if (sym < 16) {
+			lens[n++] = (BYTE)sym;
+			continue;
+		}
+
+		BYTE prev = 0;
+		DWORD rep;
+		if (sym == 16) {
+			if (n == 0) { z->bError = TRUE; return FALSE; }
+			prev = lens[n - 1];
+			rep = 3 + InflBits(z, 2);
+		}
+		else if (sym == 17) rep = 3 + InflBits(z, 3);
+		else rep = 11 + InflBits(z, 7);
+
+		if (n + rep > hlit + hdist) { z->bError = TRUE; return FALSE; }
+		while (rep--) lens[n++] = prev;
+	}
+
+	if (lens[256] == 0 ||
+		!HuffBuild(&z->lit, lens, (int)hlit) ||
+		!HuffBuild(&z->dist, lens + hlit, (int)hdist)) {
+		z->bError = TRUE;
+		return FALSE;
+	}
+	return InflCodes(z, &z->lit, &z->dist);
+}
+
+// 解一个完整的 deflate 流；返回 FALSE = 数据错误（被下游叫停时看 bStopped）
+static BOOL InflRun(INFLATE* z)
+{
+	BOOL last = FALSE;
+	while (!last && !z->bError && !z->bStopped) {
+		last = InflBits(z, 1);
+		DWORD type = InflBits(z, 2);
+		if (type == 0) InflStored(z);
+		else if (type == 1) InflCodes(z, &g_HuffFixedLit, &g_HuffFixedDist);
+		else if (type == 2) InflDynamic(z);
+		else z->bError = TRUE;
+	}
+	InflFlush(z);
+	return !z->bError;
+}
+
+// gzip 成员头（RFC 1952）；name 可为 NULL
+static BOOL GzReadHeader(INFLATE* z, char* name, DWORD cchName)
+{
+	if (InflBits(z, 8) != 0x1F || InflBits(z, 8) != 0x8B || InflBits(z, 8) != 8) return FALSE;
+	DWORD flg = InflBits(z, 8);
+	for (int i = 0; i < 6; i++) InflBits(z, 8); // MTIME XFL OS
+
+	if (flg & 0x04) {
+		DWORD xlen = InflBits(z, 16);
+		while (xlen-- && !z->bError) InflBits(z, 8);
+	}
+	if (flg & 0x08) {
+		DWORD i = 0;
+		for (;;) {
+			DWORD c = InflBits(z, 8);
+			if (z->bError || c == 0) break;
+			if (name && i + 1 < cchName) name[i++] = (char)c;
+		}
+		if (name && cchName) name[i] = '\0';
+	}
+	if (flg & 0x10) {
+		while (InflBits(z, 8) != 0 && !z->bError) {}
+	}
+	if (flg & 0x02) InflBits(z, 16);
+	return !z->bError;
+}
+
+// ---- tar（ustar / GNU 长名 / pax path）推式解析 ----
+#define TAR_SKIP 0
+#define TAR_FILE 1
+#define TAR_META 2
+
+typedef struct {
+	FILE_HASH_TASK* t;
+	MEMBER_HASH mh;
+
+	BYTE  hdr[512];
+	DWORD hdrLen;
+	ULONGLONG dataLeft;
+	DWORD padLeft;
+
+	int   kind;
+	LONG  iMember;
+
+	char* meta;          // GNU 'L' / pax 'x' 条目的内容
+	DWORD metaLen;
+	char  metaType;
+	WCHAR szNextName[MAX_PATH]; // 由长名/pax 提供，只作用于下一个条目
+
+	int   zeroBlocks;
+	BOOL  bEnd, bError;
+} TAR_PARSER;
+
+static ULONGLONG TarNumber(const BYTE* p, int n)
+{
+	ULONGLONG v = 0;
+	if (p[0] & 0x80) { // GNU base-256
+		for (int i = 1; i < n; i++) v = (v << 8) | p[i];
+		return v;
+	}
+	int i = 0;
+	while (i < n && (p[i] == ' ' || p[i] == 0)) i++;
+	for (; i < n && p[i] >= '0' && p[i] <= '7'; i++) v = (v << 3) | (ULONGLONG)(p[i] - '0');
+	return v;
+}
+
+static BOOL TarBegin(TAR_PARSER* tp, FILE_HASH_TASK* t)
+{
+	ZeroMemory(tp, sizeof(*tp));
+	tp->t = t;
+	tp->iMember = -1;
+	tp->meta = (char*)HeapAlloc(GetProcessHeap(), 0, ARC_TAR_MAX_META + 1);
+	return tp->meta && MemberHashInit(&tp->mh, t->bCalcMD5, t->bCalcSHA256);
+}
+
+static void TarEntryDone(TAR_PARSER* tp)
+{
+	if (tp->kind == TAR_FILE) {
+		MemberHashEnd(&tp->mh, &tp->t->pMembers[tp->iMember], TRUE);
+		tp->iMember = -1;
+	}
+	else if (tp->kind == TAR_META) {
+		tp->meta[tp->metaLen] = '\0';
+		if (tp->metaType == 'L') {
+			ArchiveNameToWide(tp->meta, (int)strlen(tp->meta), TRUE, tp->szNextName, _countof(tp->szNextName));
+		}
+		else {
+			// pax 记录："<len> key=value\n"
+			DWORD pos = 0;
+			while (pos < tp->metaLen) {
+				DWORD recLen = 0, k = pos;
+				while (k < tp->metaLen && tp->meta[k] >= '0' && tp->meta[k] <= '9') recLen = recLen * 10 + (DWORD)(tp->meta[k++] - '0');
+				if (recLen == 0 || pos + recLen > tp->metaLen || k >= tp->metaLen || tp->meta[k] != ' ') break;
+
+				const char* kv = tp->meta + k + 1;
+				int kvLen = (int)(pos + recLen - (k + 1)) - 1; // 去掉 '\n'
+				if (kvLen > 5 && memcmp(kv, "path=", 5) == 0) {
+					ArchiveNameToWide(kv + 5, kvLen - 5, TRUE, tp->szNextName, _countof(tp->szNextName));
+				}
+				pos += recLen;
+			}
+		}
+	}
+	tp->kind = TAR_SKIP;
+}
+
+static void TarHeader(TAR_PARSER* tp)
+{
+	const BYTE* h = tp->hdr;
+
+	BOOL allZero = TRUE;
+	for (int i = 0; i < 512 && allZero; i++) allZero = (h[i] == 0);
+	if (allZero) {
+		if (++tp->zeroBlocks >= 2) tp->bEnd = TRUE;
+		return;
+	}
+	tp->zeroBlocks = 0;
+
+	// 校验和：字段本身按空格计
+	DWORD sum = 0;
+	for (int i = 0; i < 512; i++) sum += (i >= 148 && i < 156) ? ' ' : h[i];
+	if (sum != (DWORD)TarNumber(h + 148, 8)) { tp->bError = TRUE; return; }
+
+	ULONGLONG size = TarNumber(h + 124, 12);
+	char type = (char)h[156];
+	tp->dataLeft = size;
+	tp->padLeft = (DWORD)((512 - (size & 511)) & 511);
+	tp->kind = TAR_SKIP;
+
+	if (type == 'L' || type == 'x') {
+		if (size <= ARC_TAR_MAX_META) {
+			tp->kind = TAR_META;
+			tp->metaType = type;
+			tp->metaLen = 0;
+		}
+	}
+	else if (type == '0' || type == '\0' || type == '7') {
+		WCHAR name[MAX_PATH];
+		if (tp->szNextName[0]) {
+			StringCchCopyW(name, _countof(name), tp->szNextName);
+		}
+		else {
+			char raw[256 + 1];
+			int n = 0;
+			if (memcmp(h + 257, "ustar", 5) == 0 && h[345]) {
+				while (n < 155 && h[345 + n]) { raw[n] = (char)h[345 + n]; n++; }
+				raw[n++] = '/';
+			}
+			for (int i = 0; i < 100 && h[i]; i++) raw[n++] = (char)h[i];
+			ArchiveNameToWide(raw, n, TRUE, name, _countof(name));
+		}
+
+		tp->iMember = ArchiveAddMembers(tp->t, 1);
+		if (tp->iMember >= 0) {
+			ARCHIVE_MEMBER* m = &tp->t->pMembers[tp->iMember];
+			StringCchCopyW(m->szName, _countof(m->szName), name);
+			m->ullExpectSize = size;
+			MemberHashBegin(&tp->mh);
+			tp->kind = TAR_FILE;
+		}
+	}
+	if (type != 'L' && type != 'x') tp->szNextName[0] = L'\0';
+
+	if (tp->dataLeft == 0) TarEntryDone(tp);
+}
+
+static void TarFeed(TAR_PARSER* tp, const BYTE* p, DWORD n)
+{
+	while (n > 0 && !tp->bEnd && !tp->bError) {
+		if (tp->dataLeft > 0) {
+			DWORD take = (tp->dataLeft < n) ? (DWORD)tp->dataLeft : n;
+			if (tp->kind == TAR_FILE) {
+				MemberHashFeed(&tp->mh, p, take);
+			}
+			else if (tp->kind == TAR_META) {
+				memcpy(tp->meta + tp->metaLen, p, take);
+				tp->metaLen += take;
+			}
+			tp->dataLeft -= take;
+			p += take; n -= take;
+			if (tp->dataLeft == 0) TarEntryDone(tp);
+			continue;
+		}
+		if (tp->padLeft > 0) {
+			DWORD take = (tp->padLeft < n) ? tp->padLeft : n;
+			tp->padLeft -= take;
+			p += take; n -= take;
+			continue;
+		}
+
+		DWORD take = 512 - tp->hdrLen;
+		if (take > n) take = n;
+		memcpy(tp->hdr + tp->hdrLen, p, take);
+		tp->hdrLen += take;
+		p += take; n -= take;
+		if (tp->hdrLen == 512) {
+			tp->hdrLen = 0;
+			TarHeader(tp);
+		}
+	}
+}
+
+// 返回归档是否完整解析
+static BOOL TarEnd(TAR_PARSER* tp, BOOL ok)
+{
+	if (tp->kind == TAR_FILE && tp->iMember >= 0) {
+		MemberHashEnd(&tp->mh, &tp->t->pMembers[tp->iMember], FALSE); // 截断
+		ok = FALSE;
+	}
+	if (tp->meta) HeapFree(GetProcessHeap(), 0, tp->meta);
+	MemberHashFree(&tp->mh);
+
+	if (tp->bError) return FALSE;
+	// 没有结束标记但恰好停在条目边界，也按完整处理
+	return ok && (tp->bEnd || (tp->hdrLen == 0 && tp->dataLeft == 0 && tp->padLeft == 0));
+}
+
+// gzip 流：解压输出先累计 CRC-32/ISIZE，再交给 tar 解析（tgz）或成员哈希（gz）；
+// 每个 gzip 成员结束时与其尾部比对
+typedef struct {
+	DWORD dwCrc;
+	DWORD dwSize;              // ISIZE：长度模 2^32
+	TAR_PARSER* tp;            // 非空 = tgz
+	MEMBER_HASH* mh;
+} GZ_SINK;
+
+static BOOL ArcPushGz(void* ctx, const BYTE* p, DWORD n)
+{
+	GZ_SINK* g = (GZ_SINK*)ctx;
+	g->dwCrc = Crc32Update(g->dwCrc, p, n);
+	g->dwSize += n;
+	if (!g->tp) {
+		MemberHashFeed(g->mh, p, n);
+		return TRUE;
+	}
+	// tar 结束标记之后仍解压到 gzip 尾部，CRC 才覆盖整个成员
+	if (!g->tp->bEnd) TarFeed(g->tp, p, n);
+	return !g->tp->bError;
+}
+
+static BOOL ArcPushMember(void* ctx, const BYTE* p, DWORD n)
+{
+	MemberHashFeed((MEMBER_HASH*)ctx, p, n);
+	return TRUE;
+}
+
+static DWORD ArcPullPass(void* ctx, const BYTE** pp)
+{
+	READ_PASS* rp = (READ_PASS*)ctx;
+	DWORD n = ReadPassNext(rp); // 复制模式下 buf 会轮换，读完再取
+	*pp = rp->buf;
+	return n;
+}
+
+// tar / tar.gz / gz：由归档解析驱动整文件的那一遍读取
+static void ArchiveWalkStream(FILE_HASH_TASK* t, READ_PASS* rp)
+{
+	BOOL ok = FALSE;
+
+	if (t->nArchiveKind == ARC_TAR) {
+		TAR_PARSER tp;
+		if (TarBegin(&tp, t)) {
+			DWORD n;
+			while ((n = ReadPassNext(rp)) > 0) {
+				if (!tp.bEnd && !tp.bError) TarFeed(&tp, rp->buf, n);
+			}
+			ok = TarEnd(&tp, !rp->bError);
+		}
+		else {
+			TarEnd(&tp, FALSE);
+		}
+	}
+	else {
+		TAR_PARSER tp;
+		MEMBER_HASH mh;
+		GZ_SINK gz;
+		INFLATE z;
+		BOOL isTar = (t->nArchiveKind == ARC_TGZ);
+		BOOL ready = FALSE;
+		BOOL badCrc = FALSE;
+		LONG iMember = -1;
+
+		ZeroMemory(&tp, sizeof(tp));
+		ZeroMemory(&mh, sizeof(mh));
+		ZeroMemory(&z, sizeof(z));
+		ZeroMemory(&gz, sizeof(gz));
+		gz.tp = isTar ? &tp : NULL;
+		gz.mh = &mh;
+		if (isTar) ready = TarBegin(&tp, t);
+		else ready = MemberHashInit(&mh, t->bCalcMD5, t->bCalcSHA256) && MemberHashBegin(&mh);
+		ready = ready && InflInit(&z, ArcPullPass, rp, ArcPushGz, &gz);
+
+		if (ready) {
+			// 多个 gzip 成员首尾相接时按 gunzip 语义拼成一条流
+			for (BOOL first = TRUE;; first = FALSE) {
+				char gzName[MAX_PATH];
+				gzName[0] = '\0';
+				if (!GzReadHeader(&z, gzName, _countof(gzName))) break;
+
+				if (first && !isTar) {
+					iMember = ArchiveAddMembers(t, 1);
+					if (iMember >= 0) {
+						ARCHIVE_MEMBER* m = &t->pMembers[iMember];
+						if (gzName[0]) {
+							ArchiveNameToWide(gzName, (int)strlen(gzName), TRUE, m->szName, _countof(m->szName));
+						}
+						else {
+							const WCHAR* base = wcsrchr(t->szFilePath, L'\\');
+							StringCchCopyW(m->szName, _countof(m->szName), base ? base + 1 : t->szFilePath);
+							size_t len = wcslen(m->szName);
+							if (len > 3) m->szName[len - 3] = L'\0'; // 去掉 .gz
+						}
+					}
+				}
+
+				gz.dwCrc = 0;
+				gz.dwSize = 0;
+				if (!InflRun(&z) || z.bStopped) break; // 数据错误 / tar 格式错误
+
+				// 尾部：CRC32 + ISIZE，与解压输出不符即视为损坏
+				InflBits(&z, z.bitcnt & 7);
+				DWORD crc = InflBits(&z, 16);
+				crc |= InflBits(&z, 16) << 16;
+				DWORD isize = InflBits(&z, 16);
+				isize |= InflBits(&z, 16) << 16;
+				if (z.bError) break;
+				if (crc != gz.dwCrc || isize != gz.dwSize) { badCrc = TRUE; break; }
+				if (InflAtEnd(&z)) { ok = TRUE; break; }
+			}
+		}
+		InflFree(&z);
+
+		if (isTar) {
+			ok = TarEnd(&tp, ok && !rp->bError) && ok;
+		}
+		else {
+			if (iMember >= 0) MemberHashEnd(&mh, &t->pMembers[iMember], ok && !rp->bError);
+			MemberHashFree(&mh);
+		}
+
+		// 校验和不符：已经出结果的 tar 成员也不可信
+		if (badCrc) {
+			EnterCriticalSection(&g_csTasks);
+			for (LONG i = 0; i < t->nMembers; i++) t->pMembers[i].bSuccess = FALSE;
+			LeaveCriticalSection(&g_csTasks);
+		}
+	}
+
+	// 解析提前结束（结束标记、格式错误）时也要读完剩余字节，整文件哈希才完整
+	while (ReadPassNext(rp) > 0) {}
+	t->bArchiveOk = ok && !rp->bError;
+}
+
+// ---- zip：中央目录 + 成员并行 ----
+typedef struct {
+	HANDLE h;
+	DWORD  dwVolume;
+	BYTE*  buf;
+	DWORD  cbBuf;
+	ULONGLONG left;
+	FILE_HASH_TASK* t;
+	BOOL   bError;
+} ZIP_SRC;
+
+static DWORD ZipPull(void* ctx, const BYTE** pp)
+{
+	ZIP_SRC* s = (ZIP_SRC*)ctx;
+	if (s->bError || s->left == 0) return 0;
+	if (InterlockedCompareExchange(&g_lCancelAll, 0, 0) != 0 || InterlockedCompareExchange(&s->t->bCanceled, 0, 0) != 0) {
+		InterlockedExchange(&s->t->bCanceled, 1);
+		s->bError = TRUE;
+		return 0;
+	}
+
+	DWORD want = (s->left < s->cbBuf) ? (DWORD)s->left : s->cbBuf;
+	DWORD got = 0;
+	if (!ThrottledRead(s->h, s->buf, want, &got, s->dwVolume) || got == 0) { s->bError = TRUE; return 0; }
+
+	s->left -= got;
+	InterlockedAdd64(&g_llDoneBytesAll, (LONGLONG)got);
+	*pp = s->buf;
+	return got;
+}
+
+static BOOL ReadAt(HANDLE h, ULONGLONG off, BYTE* p, DWORD cb, DWORD vol)
+{
+	LARGE_INTEGER li; li.QuadPart = (LONGLONG)off;
+	DWORD got = 0;
+	return SetFilePointerEx(h, li, NULL, FILE_BEGIN) && ThrottledReadFull(h, p, cb, &got, vol) && got == cb;
+}
+
+static void ZipHashMember(ARCHIVE_MEMBER* m)
+{
+	FILE_HASH_TASK* t = m->pTask;
+	BOOL ok = FALSE;
+	MEMBER_HASH mh;
+	ZIP_SRC src;
+	BYTE lh[30];
+
+	ZeroMemory(&src, sizeof(src));
+	src.h = INVALID_HANDLE_VALUE;
+	src.t = t;
+	src.left = m->ullCompSize;
+
+	if (!MemberHashInit(&mh, t->bCalcMD5, t->bCalcSHA256) || !MemberHashBegin(&mh)) goto done;
+	mh.bCrc = TRUE;
+	if ((m->wFlags & 0x0001) || (m->wMethod != 0 && m->wMethod != 8)) goto done; // 加密/不支持的压缩方式
+
+	src.h = CreateFileW(t->szFilePath, GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (src.h == INVALID_HANDLE_VALUE) goto done;
+	src.dwVolume = VolumeOfHandle(src.h);
+
+	if (!ReadAt(src.h, m->ullLocalOffset, lh, sizeof(lh), src.dwVolume) || Le32(lh) != 0x04034B50) goto done;
+	if (!(m->wFlags & 0x0008) && Le32(lh + 14) != m->dwCrc) goto done; // 无数据描述符时本地头与目录须一致
+	{
+		LARGE_INTEGER li;
+		li.QuadPart = (LONGLONG)(m->ullLocalOffset + sizeof(lh) + Le16(lh + 26) + Le16(lh + 28));
+		if (!SetFilePointerEx(src.h, li, NULL, FILE_BEGIN)) goto done;
+	}
+
+	src.buf = MemAcquire(ARC_MEMBER_BUF_SIZE, MEM_GRAIN, &src.cbBuf, TRUE, &t->bCanceled);
+	if (!src.buf) goto done;
+
+	if (m->wMethod == 0) {
+		const BYTE* p;
+		DWORD n;
+		while ((n = ZipPull(&src, &p)) > 0) MemberHashFeed(&mh, p, n);
+		ok = !src.bError && src.left == 0;
+	}
+	else {
+		INFLATE z;
+		if (InflInit(&z, ZipPull, &src, ArcPushMember, &mh)) ok = InflRun(&z) && !src.bError;
+		InflFree(&z);
+	}
+	ok = ok && (mh.ullBytes == m->ullExpectSize) && (mh.dwCrc == m->dwCrc);
+
+done:
+	MemRelease(src.buf, src.cbBuf);
+	if (src.h != INVALID_HANDLE_VALUE) CloseHandle(src.h);
+	InterlockedAdd64(&g_llDoneBytesAll, (LONGLONG)src.left); // 未读部分（失败/取消）对账
+	MemberHashEnd(&mh, m, ok);
+	MemberHashFree(&mh);
+	RequestUiUpdate();
+}
+
+static VOID CALLBACK ZipMemberCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context)
+{
+	(void)Instance;
+	ARCHIVE_MEMBER* m = (ARCHIVE_MEMBER*)Context;
+	FILE_HASH_TASK* t = m->pTask;
+
+	ZipHashMember(m);
+	BackgroundLeave();
+	if (InterlockedDecrement(&t->lPendingMembers) == 0) FinishTask(t);
+}
+
+// 解析中央目录并把成员提交到线程池；每提交一个 lPendingMembers +1
+static void ZipScheduleMembers(FILE_HASH_TASK* t)
+{
+	BYTE* tail = NULL;
+	BYTE* cd = NULL;
+	LONG first = -1, nFiles = 0;
+	ULONGLONG cdCount = 0, cdSize = 0, cdOffset = 0;
+	ULONGLONG compTotal = 0;
+	DWORD tailLen = 0, eocd = 0, vol = 0;
+	BOOL found = FALSE;
+	LARGE_INTEGER li;
+
+	HANDLE h = CreateFileW(t->szFilePath, GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (h == INVALID_HANDLE_VALUE) goto done;
+	vol = VolumeOfHandle(h);
+	if (!GetFileSizeEx(h, &li) || li.QuadPart < 22) goto done;
+
+	// EOCD 在最后 22 + 65535（注释）字节内
+	tailLen = (li.QuadPart < 22 + 65535) ? (DWORD)li.QuadPart : 22 + 65535;
+	tail = (BYTE*)HeapAlloc(GetProcessHeap(), 0, tailLen);
+	if (!tail || !ReadAt(h, (ULONGLONG)li.QuadPart - tailLen, tail, tailLen, vol)) goto done;
+
+	for (eocd = tailLen - 22 + 1; eocd-- > 0;) {
+		if (Le32(tail + eocd) == 0x06054B50) { found = TRUE; break; }
+	}
+	if (!found || Le16(tail + eocd + 4) != 0) goto done; // 不支持分卷
+
+	cdCount = Le16(tail + eocd + 10);
+	cdSize = Le32(tail + eocd + 12);
+	cdOffset = Le32(tail + eocd + 16);
+
+	if (cdCount == 0xFFFF || cdSize == 0xFFFFFFFF || cdOffset == 0xFFFFFFFF) {
+		// ZIP64：EOCD 前 20 字节是定位符
+		BYTE z64[56];
+		if (eocd < 20 || Le32(tail + eocd - 20) != 0x07064B50) goto done;
+		if (!ReadAt(h, Le64(tail + eocd - 20 + 8), z64, sizeof(z64), vol) || Le32(z64) != 0x06064B50) goto done;
+		cdCount = Le64(z64 + 32);
+		cdSize = Le64(z64 + 40);
+		cdOffset = Le64(z64 + 48);
+	}
+	if (cdSize > ARC_ZIP_MAX_CD || cdOffset + cdSize > (ULONGLONG)li.QuadPart) goto done;
+
+	cd = (BYTE*)HeapAlloc(GetProcessHeap(), 0, (SIZE_T)cdSize + 1);
+	if (!cd || !ReadAt(h, cdOffset, cd, (DWORD)cdSize, vol)) goto done;
+
+	// 两遍：先数文件成员（跳过目录），再一次性分配，保证成员指针在并行期间不变
+	for (int pass = 0; pass < 2; pass++) {
+		DWORD pos = 0;
+		LONG idx = 0;
+		for (ULONGLONG i = 0; i < cdCount; i++) {
+			if (pos + 46 > cdSize || Le32(cd + pos) != 0x02014B50) goto done;
+			const BYTE* e = cd + pos;
+			WORD nameLen = Le16(e + 28), extraLen = Le16(e + 30), commentLen = Le16(e + 32);
+			if (pos + 46 + (DWORD)nameLen + extraLen + commentLen > cdSize) goto done;
+
+			const char* name = (const char*)(e + 46);
+			BOOL isDir = (nameLen > 0 && (name[nameLen - 1] == '/' || name[nameLen - 1] == '\\'));
+			if (!isDir && idx < ARC_MAX_MEMBERS) {
+				if (pass == 1) {
+					ARCHIVE_MEMBER* m = &t->pMembers[first + idx];
+					m->pTask = t;
+					m->wFlags = Le16(e + 8);
+					m->wMethod = Le16(e + 10);
+					m->dwCrc = Le32(e + 16);
+					m->ullCompSize = Le32(e + 20);
+					m->ullExpectSize = Le32(e + 24);
+					m->ullLocalOffset = Le32(e + 42);
+					ArchiveNameToWide(name, nameLen, (m->wFlags & 0x0800) != 0, m->szName, _countof(m->szName));
+
+					// ZIP64 扩展信息：仅包含 32 位字段为 0xFFFFFFFF 的那些，按固定顺序
+					const BYTE* x = e + 46 + nameLen;
+					const BYTE* xEnd = x + extraLen;
+					while (x + 4 <= xEnd) {
+						WORD id = Le16(x), sz = Le16(x + 2);
+						const BYTE* v = x + 4;
+						if (v + sz > xEnd) break;
+						if (id == 0x0001) {
+							const BYTE* vEnd = v + sz;
+							if (m->ullExpectSize == 0xFFFFFFFF && v + 8 <= vEnd) { m->ullExpectSize = Le64(v); v += 8; }
+							if (m->ullCompSize == 0xFFFFFFFF && v + 8 <= vEnd) { m->ullCompSize = Le64(v); v += 8; }
+							if (m->ullLocalOffset == 0xFFFFFFFF && v + 8 <= vEnd) { m->ullLocalOffset = Le64(v); v += 8; }
+						}
+						x += 4 + sz;
+					}
+					compTotal += m->ullCompSize;
+				}
+				idx++;
+			}
+			pos += 46 + nameLen + extraLen + commentLen;
+		}
+		if (pass == 0) {
+			nFiles = idx;
+			if (nFiles == 0) { t->bArchiveOk = TRUE; goto done; }
+			first = ArchiveAddMembers(t, nFiles);
+			if (first < 0) goto done;
+		}
+	}
+
+	InterlockedAdd64(&g_llTotalBytesAll, (LONGLONG)compTotal);
+	for (LONG i = 0; i < nFiles; i++) {
+		ARCHIVE_MEMBER* m = &t->pMembers[first + i];
+		InterlockedIncrement(&t->lPendingMembers);
+		if (!TrySubmitThreadpoolCallback(ZipMemberCallback, m, &g_callEnv)) {
+			InterlockedAdd64(&g_llDoneBytesAll, (LONGLONG)m->ullCompSize);
+			InterlockedExchange(&m->bFinished, 1);
+			InterlockedDecrement(&t->lPendingMembers);
+		}
+	}
+	t->bArchiveOk = TRUE;
+	nFiles = 0; // 已交给成员回调
+
+done:
+	if (first >= 0 && nFiles > 0) {
+		// 中央目录解析到一半失败：已分配的成员行标记为失败
+		for (LONG i = 0; i < nFiles; i++) InterlockedExchange(&t->pMembers[first + i].bFinished, 1);
+	}
+	if (cd) HeapFree(GetProcessHeap(), 0, cd);
+	if (tail) HeapFree(GetProcessHeap(), 0, tail);
+	if (h != INVALID_HANDLE_VALUE) CloseHandle(h);
+	MarkTextDirtyAndRequest();
+}
+
+// ---------------- 边复制边哈希（HT_CopyFile） ----------------
+// 源文件只读一遍：每块哈希后重叠写入目标（双缓冲，写上一块时读下一块）。
+// 目标先写 <目标>.tmp，可选无缓冲回读校验，通过后才改名。
+#define COPY_VERIFY_NONE     0
+#define COPY_VERIFY_MATCH    1
+#define COPY_VERIFY_MISMATCH 2
+#define COPY_VERIFY_ERROR    3
+
+typedef struct COPY_SINK {
+	HANDLE hDst;                       // FILE_FLAG_OVERLAPPED
+	WCHAR  szTmpPath[MAX_PATH];
+	BYTE*  buf[2];                     // 均由调用方提供：同一次预算申请切成两半
+	DWORD  cbBuf;
+	int    iCur;                       // 下一次读入哪个缓冲
+	OVERLAPPED ov;
+	BOOL   bPending;
+	DWORD  dwPendingLen;
+	ULONGLONG ullOffset;               // 下一次写入位置
+	BOOL   bFailed;
+} COPY_SINK;
+
+static BOOL CopyWait(COPY_SINK* c)
+{
+	if (c->bPending) {
+		DWORD w = 0;
+		c->bPending = FALSE;
+		if (!GetOverlappedResult(c->hDst, &c->ov, &w, TRUE) || w != c->dwPendingLen) c->bFailed = TRUE;
+	}
+	return !c->bFailed;
+}
+
+static BYTE* CopyNextBuffer(COPY_SINK* c)
+{
+	return c->buf[c->iCur];
+}
+
+// 另一个缓冲上的写入完成后才发起本次写入，随即切换缓冲，让下一次读与本次写重叠
+static void CopyWrite(COPY_SINK* c, const BYTE* p, DWORD n)
+{
+	if (!CopyWait(c)) return;
+
+	c->ov.Offset = (DWORD)c->ullOffset;
+	c->ov.OffsetHigh = (DWORD)(c->ullOffset >> 32);
+	c->dwPendingLen = n;
+	if (!WriteFile(c->hDst, p, n, NULL, &c->ov) && GetLastError() != ERROR_IO_PENDING) {
+		c->bFailed = TRUE;
+		return;
+	}
+	c->bPending = TRUE; // 同步完成时事件同样已置位
+	c->ullOffset += n;
+	c->iCur ^= 1;
+}
+
+static BOOL CopyBegin(COPY_SINK* c, FILE_HASH_TASK* t, BYTE* buf, BYTE* buf2, DWORD cbBuf)
+{
+	ZeroMemory(c, sizeof(*c));
+	c->hDst = INVALID_HANDLE_VALUE;
+	c->buf[0] = buf;
+	c->buf[1] = buf2;
+	c->cbBuf = cbBuf;
+	c->bFailed = TRUE;
+
+	if (FAILED(StringCchPrintfW(c->szTmpPath, _countof(c->szTmpPath), L"%s.tmp", t->szCopyDest))) {
+		c->szTmpPath[0] = L'\0';
+		return FALSE;
+	}
+
+	c->ov.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	if (!c->ov.hEvent) return FALSE;
+
+	c->hDst = CreateFileW(c->szTmpPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+	if (c->hDst == INVALID_HANDLE_VALUE) return FALSE;
+
+	// 预先设好长度：扩展文件的写入会被系统同步执行，预分配后才能真正重叠
+	LARGE_INTEGER li; li.QuadPart = (LONGLONG)t->ullFileSize;
+	if (li.QuadPart > 0 && SetFilePointerEx(c->hDst, li, NULL, FILE_BEGIN)) SetEndOfFile(c->hDst);
+
+	c->bFailed = FALSE;
+	return TRUE;
+}
+
+// 无缓冲回读目标并与源摘要比较；expect = 实际写入（即已哈希）的字节数，返回 COPY_VERIFY_*
+static int CopyVerify(FILE_HASH_TASK* t, const WCHAR* path, BYTE* buf, DWORD cbBuf, ULONGLONG expect)
+{
+	int res = COPY_VERIFY_ERROR;
+	ULONGLONG left = expect, n = 0;
+	ARCHIVE_MEMBER out;   // 借用成员结果结构存放回读摘要
+	MEMBER_HASH mh;
+
+	ZeroMemory(&out, sizeof(out));
+	ZeroMemory(&mh, sizeof(mh)); // 目标打不开时 MemberHashFree 仍会执行
+	InterlockedAdd64(&g_llTotalBytesAll, (LONGLONG)left);
+
+	HANDLE h = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (h != INVALID_HANDLE_VALUE &&
+		MemberHashInit(&mh, t->bCalcMD5 && t->bSuccessMD5, t->bCalcSHA256 && t->bSuccessSHA256) &&
+		MemberHashBegin(&mh)) {
+		BOOL ok = TRUE;
+		DWORD vol = VolumeOfHandle(h);
+		for (;;) {
+			if (InterlockedCompareExchange(&g_lCancelAll, 0, 0) != 0 || InterlockedCompareExchange(&t->bCanceled, 0, 0) != 0) {
+				InterlockedExchange(&t->bCanceled, 1);
+				ok = FALSE;
+				break;
+			}
+
+			// 无缓冲读：缓冲按页对齐、请求长度为扇区整数倍，末块可返回不足
+			DWORD got = 0;
+			if (!ThrottledRead(h, buf, cbBuf, &got, vol)) { ok = FALSE; break; }
+			if (got == 0) break;
+
+			MemberHashFeed(&mh, buf, got);
+			n = (got < left) ? got : left;
+			left -= n;
+			InterlockedAdd64(&g_llDoneBytesAll, (LONGLONG)n);
+			RequestUiUpdate();
+		}
+		ok = ok && (mh.ullBytes == expect);
+		MemberHashEnd(&mh, &out, ok);
+
+		if (out.bSuccess) {
+			BOOL same = TRUE;
+			if (mh.bMD5 && wcscmp(out.szMD5Value, t->szMD5Value) != 0) same = FALSE;
+			if (mh.bSHA && wcscmp(out.szSHA256Value, t->szSHA256Value) != 0) same = FALSE;
+			res = same ? COPY_VERIFY_MATCH : COPY_VERIFY_MISMATCH;
+		}
+		else if (ok && mh.ullBytes != expect) {
+			res = COPY_VERIFY_MISMATCH;
+		}
+	}
+	MemberHashFree(&mh);
+	if (h != INVALID_HANDLE_VALUE) CloseHandle(h);
+
+	InterlockedAdd64(&g_llDoneBytesAll, (LONGLONG)left); // 对账
+	return res;
+}
+
+// ok = 源读取与哈希是否成功；收尾、校验并改名，返回目标是否落地
+static BOOL CopyEnd(COPY_SINK* c, FILE_HASH_TASK* t, BOOL ok, BYTE* buf)
+{
+	BOOL landed = FALSE;
+
+	if (c->hDst != INVALID_HANDLE_VALUE) {
+		ok = CopyWait(c) && ok;
+		if (ok) {
+			// 源在读取期间变短/变长时以实际写入为准
+			LARGE_INTEGER li; li.QuadPart = (LONGLONG)c->ullOffset;
+			ok = SetFilePointerEx(c->hDst, li, NULL, FILE_BEGIN) && SetEndOfFile(c->hDst);
+			if (ok) SetFileTime(c->hDst, NULL, NULL, &t->ftModify);
+			if (ok && t->bCopyVerify) ok = FlushFileBuffers(c->hDst);
+		}
+		CloseHandle(c->hDst);
+		c->hDst = INVALID_HANDLE_VALUE;
+	}
+	else {
+		ok = FALSE;
+	}
+
+	if (ok && t->bCopyVerify) {
+		t->nVerifyResult = CopyVerify(t, c->szTmpPath, buf, c->cbBuf, c->ullOffset);
+		ok = (t->nVerifyResult == COPY_VERIFY_MATCH);
+	}
+
+	if (c->szTmpPath[0]) {
+		landed = ok && MoveFileExW(c->szTmpPath, t->szCopyDest, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+		if (!landed) DeleteFileW(c->szTmpPath);
+		c->szTmpPath[0] = L'\0';
+	}
+
+	if (c->ov.hEvent) CloseHandle(c->ov.hEvent);
+	ZeroMemory(c, sizeof(*c));
+	c->hDst = INVALID_HANDLE_VALUE;
+	return landed;
+}
+
+// ---------------- Hash 计算（原样：含 done 补齐） ----------------
+static BOOL CalculateHashes_WithProgress(FILE_HASH_TASK* t)
+{
+	if (!t) return FALSE;
+
+	BOOL ok = FALSE;
+	HANDLE hFile = INVALID_HANDLE_VALUE;
+	BYTE* buf = NULL;
+	DWORD cbAll = 0, cbBuf = 0;
+	DWORD nBufs = t->szCopyDest[0] ? 2 : 1; // 复制模式双缓冲
+
+	ULONGLONG done = 0;
+	ULONGLONG hashed = 0;
+	DWORD lastUi = 0;
+
+	NTSTATUS st = 0;
+	BCRYPT_HASH_HANDLE hMd5 = NULL, hSha = NULL;
+
+	PUCHAR objMd5 = NULL, objSha = NULL;
+	PUCHAR outMd5 = NULL, outSha = NULL;
+
+	CDC_STATE cdc;
+	BOOL bCdc = FALSE;
+	PIECE_STATE pcs;
+	BOOL bPieces = FALSE;
+
+	COPY_SINK copy;
+	BOOL bCopy = FALSE;
+
+	SPARSE_MAP sparse;
+
+	FAN_OUT fan;
+	BOOL bFan = FALSE;
+
+	READ_PASS rp;
+	BOOL bStreamArchive = (t->nArchiveKind == ARC_TAR || t->nArchiveKind == ARC_TGZ || t->nArchiveKind == ARC_GZ);
+
+	LARGE_INTEGER sz; sz.QuadPart = 0;
+
+	hFile = CreateFileW(
+		t->szFilePath,
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+		NULL
+	);
+	if (hFile == INVALID_HANDLE_VALUE) goto cleanup;
+
+	if (GetFileSizeEx(hFile, &sz)) {
+		t->ullFileSize = (ULONGLONG)sz.QuadPart;
+	}
+
+	if (t->bCalcMD5) {
+		objMd5 = (PUCHAR)HeapAlloc(GetProcessHeap(), 0, g_dwObjLenMD5);
+		outMd5 = (PUCHAR)HeapAlloc(GetProcessHeap(), 0, g_dwHashLenMD5);
+		if (!objMd5 || !outMd5) goto cleanup;
+
+		st = BCryptCreateHash(g_hAlgMD5, &hMd5, objMd5, g_dwObjLenMD5, NULL, 0, 0);
+		if (st != 0) goto cleanup;
+	}
+
+	if (t->bCalcSHA256) {
+		objSha = (PUCHAR)HeapAlloc(GetProcessHeap(), 0, g_dwObjLenSHA);
+		outSha = (PUCHAR)HeapAlloc(GetProcessHeap(), 0, g_dwHashLenSHA);
+		if (!objSha || !outSha) goto cleanup;
+
+		st = BCryptCreateHash(g_hAlgSHA256, &hSha, objSha, g_dwObjLenSHA, NULL, 0, 0);
+		if (st != 0) goto cleanup;
+	}
+
+	// 预算紧张时缩小读块；连最小块都没有时在这里等其他任务归还
+	buf = MemAcquire(IO_BUF_SIZE * nBufs, IO_BUF_MIN * nBufs, &cbAll, TRUE, &t->bCanceled);
+	if (!buf) {
+		if (InterlockedCompareExchange(&g_lCancelAll, 0, 0) != 0) InterlockedExchange(&t->bCanceled, 1);
+		goto cleanup;
+	}
+	cbBuf = (cbAll / nBufs) & ~(MEM_GRAIN - 1);
+
+	done = 0;
+	lastUi = GetTickCount();
+	InterlockedExchange64(&t->llDoneBytes, 0);
+	t->ullResumedFrom = 0;
+
+	t->bChunkManifest = (InterlockedCompareExchange(&g_bChunkManifest, 0, 0) != 0);
+	t->bChunkOk = FALSE;
+	t->ullChunkCount = 0;
+	if (t->bChunkManifest) {
+		WCHAR dir[MAX_PATH];
+		EnterCriticalSection(&g_csTasks);
+		StringCchCopyW(dir, _countof(dir), g_szChunkDir);
+		LeaveCriticalSection(&g_csTasks);
+
+		bCdc = TRUE;
+		if (!CdcBegin(&cdc, t->szFilePath, dir)) cdc.bFailed = TRUE;
+	}
+
+	t->dwPieceSize = (DWORD)InterlockedCompareExchange(&g_lPieceSize, 0, 0);
+	t->bPiecesOk = FALSE;
+	t->ullPieceCount = 0;
+	if (t->dwPieceSize) {
+		WCHAR dir[MAX_PATH];
+		EnterCriticalSection(&g_csTasks);
+		StringCchCopyW(dir, _countof(dir), g_szPieceDir);
+		LeaveCriticalSection(&g_csTasks);
+
+		bPieces = TRUE;
+		if (!PieceBegin(&pcs, t->szFilePath, dir, t->dwPieceSize)) pcs.bFailed = TRUE;
+	}
+
+	t->bCopyOk = FALSE;
+	t->nVerifyResult = COPY_VERIFY_NONE;
+	if (t->szCopyDest[0]) {
+		bCopy = TRUE;
+		if (!CopyBegin(&copy, t, buf, buf + cbBuf, cbBuf)) copy.bFailed = TRUE;
+	}
+
+	// 分块清单/分片哈希/归档成员/复制需要完整的一遍读取，不能续算
+	if (InterlockedCompareExchange(&g_bAppendAware, 0, 0) != 0 && !bCdc && !bPieces && !bStreamArchive && !bCopy) {
+		ULONGLONG resumeAt = ResumeTryRestore(t, hFile, buf, &hMd5, objMd5, &hSha, objSha);
+		if ((t->bCalcMD5 && !hMd5) || (t->bCalcSHA256 && !hSha)) goto cleanup;
+		if (resumeAt) {
+			t->ullResumedFrom = resumeAt;
+			done = resumeAt;
+			InterlockedExchange64(&t->llDoneBytes, (LONGLONG)done);
+			InterlockedAdd64(&g_llDoneBytesAll, (LONGLONG)done);
+		}
+	}
+
+	ZeroMemory(&rp, sizeof(rp));
+	rp.t = t;
+	rp.hFile = hFile;
+	rp.dwVolume = VolumeOfHandle(hFile);
+	rp.ioBuf = buf;
+	rp.buf = buf;
+	rp.sparse = SparseBegin(&sparse, hFile, t->ullFileSize) ? &sparse : NULL;
+	rp.cbBuf = cbBuf;
+	rp.done = done;
+	rp.lastUi = lastUi;
+	rp.hMd5 = hMd5;
+	rp.hSha = hSha;
+	rp.cdc = bCdc ? &cdc : NULL;
+	rp.pcs = bPieces ? &pcs : NULL;
+	rp.copy = (bCopy && !copy.bFailed) ? &copy : NULL;
+
+	// 复制模式已让读写重叠，且复制缓冲自行轮换，不再分核
+	if (!bCopy) bFan = FanBegin(&fan, buf, cbBuf, t->ullFileSize, hMd5, hSha, rp.cdc);
+	rp.fan = bFan ? &fan : NULL;
+	if (bFan) rp.cdc = NULL; // 逐块 SHA-256 在分块车道上与读盘重叠；CdcEnd 仍在 FanEnd 之后
+
+	// tar/gz 成员在同一遍读取中边解压边哈希；zip 成员已在 WorkCallback 中另行调度
+	if (bStreamArchive) ArchiveWalkStream(t, &rp);
+	else while (ReadPassNext(&rp) > 0) {}
+
+	ok = !rp.bError;
+	if (bFan) {
+		if (!FanEnd(&fan, TRUE)) ok = FALSE;
+		bFan = FALSE;
+	}
+	done = rp.done;
+	t->ullSparseBytes = rp.ullSparse;
+	hashed = done;
+
+	// ✅ 对账补齐（原样）
+	if (InterlockedCompareExchange(&t->bCanceled, 0, 0) == 0) {
+		ULONGLONG fileSize = t->ullFileSize;
+		if (done > fileSize) done = fileSize;
+
+		if (done < fileSize) {
+			LONGLONG remain = (LONGLONG)(fileSize - done);
+			InterlockedAdd64(&g_llDoneBytesAll, remain);
+			done = fileSize;
+			InterlockedExchange64(&t->llDoneBytes, (LONGLONG)done);
+		}
+	}
+
+	if (ok) {
+		if (InterlockedCompareExchange(&g_bAppendAware, 0, 0) != 0 && !bStreamArchive) {
+			ResumeSave(t, hFile, buf, hashed, hMd5, hSha);
+		}
+		if (hMd5) {
+			st = BCryptFinishHash(hMd5, outMd5, g_dwHashLenMD5, 0);
+			if (st == 0) {
+				BinToHexUpper(outMd5, g_dwHashLenMD5, t->szMD5Value, _countof(t->szMD5Value));
+				t->bSuccessMD5 = TRUE;
+			}
+			else {
+				t->bSuccessMD5 = FALSE;
+			}
+		}
+		if (hSha) {
+			st = BCryptFinishHash(hSha, outSha, g_dwHashLenSHA, 0);
+			if (st == 0) {
+				BinToHexUpper(outSha, g_dwHashLenSHA, t->szSHA256Value, _countof(t->szSHA256Value));
+				t->bSuccessSHA256 = TRUE;
+			}
+			else {
+				t->bSuccessSHA256 = FALSE;
+			}
+		}
+	}
+
+	if (bCopy) {
+		t->bCopyOk = CopyEnd(&copy, t, ok, buf);
+		bCopy = FALSE;
+	}
+	if (bCdc) {
+		t->bChunkOk = CdcEnd(&cdc, ok);
+		t->ullChunkCount = cdc.ullCount;
+		bCdc = FALSE;
+	}
+	if (bPieces) {
+		t->bPiecesOk = PieceEnd(&pcs, ok);
+		t->ullPieceCount = pcs.ullCount;
+		bPieces = FALSE;
+	}
+
+cleanup:
+	if (bFan) FanEnd(&fan, TRUE);
+	if (bCopy) CopyEnd(&copy, t, FALSE, buf);
+	if (bCdc) CdcEnd(&cdc, FALSE);
+	if (bPieces) PieceEnd(&pcs, FALSE);
+	MemRelease(buf, cbAll);
+
+	if (hMd5) BCryptDestroyHash(hMd5);
+	if (hSha) BCryptDestroyHash(hSha);
+
+	if (objMd5) HeapFree(GetProcessHeap(), 0, objMd5);
+	if (objSha) HeapFree(GetProcessHeap(), 0, objSha);
+	if (outMd5) HeapFree(GetProcessHeap(), 0, outMd5);
+	if (outSha) HeapFree(GetProcessHeap(), 0, outSha);
+
+	if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+
+	InterlockedExchange(&g_bTextDirty, 1);
+	RequestUiUpdate();
+	return ok;
+}
+
+// ---------------- 线程池管理（原样） ----------------
+static void EnsureThreadPool(void)
+{
+	if (g_pool) return;
+
+	g_pool = CreateThreadpool(NULL);
+	if (!g_pool) return;
+
+	g_cleanup = CreateThreadpoolCleanupGroup();
+	if (!g_cleanup) {
+		CloseThreadpool(g_pool);
+		g_pool = NULL;
+		return;
+	}
+
+	InitializeThreadpoolEnvironment(&g_callEnv);
+	SetThreadpoolCallbackPool(&g_callEnv, g_pool);
+	SetThreadpoolCallbackCleanupGroup(&g_callEnv, g_cleanup, NULL);
+
+	SYSTEM_INFO si; GetSystemInfo(&si);
+	LONG n = (LONG)(si.dwNumberOfProcessors ? si.dwNumberOfProcessors : 1);
+	if (n < 1) n = 1;
+	g_lPoolThreads = n;
+	g_dwCpuCount = (DWORD)n;
+
+	SetThreadpoolThreadMinimum(g_pool, (DWORD)n);
+	SetThreadpoolThreadMaximum(g_pool, (DWORD)n);
+
+	// 车道池上限按读线程上限（64）配足：每个读线程的车道都能拿到线程，读线程不会空等
+	g_lanePool = CreateThreadpool(NULL);
+	if (g_lanePool) {
+		InitializeThreadpoolEnvironment(&g_laneEnv);
+		SetThreadpoolCallbackPool(&g_laneEnv, g_lanePool);
+		SetThreadpoolThreadMaximum(g_lanePool, FAN_LANES * 64);
+		SetThreadpoolThreadMinimum(g_lanePool, 0);
+	}
+}
+
+static void ApplyThreadPoolSize(LONG n)
+{
+	if (!g_pool) return;
+	if (n < 1) n = 1;
+	if (n > 64) n = 64;
+
+	SetThreadpoolThreadMaximum(g_pool, (DWORD)n);
+	SetThreadpoolThreadMinimum(g_pool, (DWORD)n);
+	g_lPoolThreads = n;
+}
+
+// ---------------- WorkCallback（原样：total delta 修正唯一点） ----------------
+static VOID CALLBACK WorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PTP_WORK Work)
+{
+	(void)Instance; (void)Work;
+	FILE_HASH_TASK* t = (FILE_HASH_TASK*)Context;
+	if (!t) return;
+
+	BackgroundSync();
+	t->ullStartTick = NowTick64();
+
+	WIN32_FILE_ATTRIBUTE_DATA fad = { 0 };
+	if (GetFileAttributesExW(t->szFilePath, GetFileExInfoStandard, &fad)) {
+		t->ftModify = fad.ftLastWriteTime;
+		GetFileVersionStr(t->szFilePath, t->szFileVersion, _countof(t->szFileVersion));
+	}
+
+	ULONGLONG realSize = t->ullFileSizeInit;
+	HANDLE hf = CreateFileW(
+		t->szFilePath, GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+		NULL
+	);
+	if (hf != INVALID_HANDLE_VALUE) {
+		LARGE_INTEGER li;
+		if (GetFileSizeEx(hf, &li)) realSize = (ULONGLONG)li.QuadPart;
+		CloseHandle(hf);
+	}
 
 	// ✅ total delta 修正：只在这里做（原样）
 	if (realSize != t->ullFileSizeInit) {
@@ -549,28 +3249,44 @@ static VOID CALLBACK WorkCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context,
 	}
 	t->ullFileSize = realSize;
 
-	(void)CalculateHashes_WithProgress(t);
+	// 归档成员：zip 成员并行读取，主遍只负责整文件哈希；主遍自己也持有一份 pending
+	EnterCriticalSection(&g_csTasks);
+	ArchiveFreeMembers_Locked(t);
+	LeaveCriticalSection(&g_csTasks);
+	t->bArchiveOk = FALSE;
+	t->nArchiveKind = (InterlockedCompareExchange(&g_bArchiveMembers, 0, 0) != 0)
+		? ArchiveKindFromPath(t->szFilePath) : ARC_NONE;
+	InterlockedExchange(&t->lPendingMembers, 1);
+	if (t->nArchiveKind == ARC_ZIP) ZipScheduleMembers(t);
 
-	t->ullEndTick = NowTick64();
-	InterlockedExchange(&t->bFinished, 1);
+	(void)CalculateHashes_WithProgress(t);
+	BackgroundLeave();
 
-	InterlockedDecrement(&g_lRunningCount);
-	MarkTextDirtyAndRequest();
+	if (InterlockedDecrement(&t->lPendingMembers) == 0) FinishTask(t);
 }
 
 // ---------------- 添加文件（原样：total 初值唯一点） ----------------
-static BOOL TaskExists_Locked(const WCHAR* path)
+// 同一源复制到不同目标算不同任务
+static FILE_HASH_TASK* FindTask_Locked(const WCHAR* path, const WCHAR* dest)
+{
+	for (int i = 0; i < g_nTaskCount; i++) {
+		if (_wcsicmp(g_Tasks[i].szFilePath, path) == 0 &&
+			_wcsicmp(g_Tasks[i].szCopyDest, dest ? dest : L"") == 0) return &g_Tasks[i];
+	}
+	return NULL;
+}
+
+static BOOL TaskExists_Locked(const WCHAR* path, const WCHAR* dest)
 {
-	for (int i = 0; i < g_nTaskCount; i++) {
-		if (_wcsicmp(g_Tasks[i].szFilePath, path) == 0) return TRUE;
-	}
-	return FALSE;
+	return FindTask_Locked(path, dest) != NULL;
 }
 
-static void AddOneFile_Locked(const WCHAR* path, BOOL bMD5, BOOL bSHA)
+// dest 非空 = 复制模式
+// 返回 FALSE = 任务表已满或无法创建任务；已存在视为成功
+static BOOL AddOneFile_Locked(const WCHAR* path, BOOL bMD5, BOOL bSHA, const WCHAR* dest, BOOL verify)
 {
-	if (g_nTaskCount >= MAX_TASKS) return;
-	if (TaskExists_Locked(path)) return;
+	if (TaskExists_Locked(path, dest)) return TRUE;
+	if (g_nTaskCount >= MAX_TASKS) return FALSE;
 
 	FILE_HASH_TASK* t = &g_Tasks[g_nTaskCount];
 	ZeroMemory(t, sizeof(*t));
@@ -578,6 +3294,10 @@ static void AddOneFile_Locked(const WCHAR* path, BOOL bMD5, BOOL bSHA)
 	StringCchCopyW(t->szFilePath, _countof(t->szFilePath), path);
 	t->bCalcMD5 = bMD5;
 	t->bCalcSHA256 = bSHA;
+	if (dest) {
+		StringCchCopyW(t->szCopyDest, _countof(t->szCopyDest), dest);
+		t->bCopyVerify = verify;
+	}
 
 	InterlockedExchange(&t->lLastUiPctNotified, -1);
 
@@ -594,6 +3314,16 @@ static void AddOneFile_Locked(const WCHAR* path, BOOL bMD5, BOOL bSHA)
 	// ✅ total += initSize（第一处，原样）
 	InterlockedAdd64(&g_llTotalBytesAll, (LONGLONG)initSize);
 
+	// 瘦客户端：请求在出锁后由 SvcConnSendPending 发出
+	if (!dest && SvcConnActive()) {
+		t->bRemote = TRUE;
+		t->ullStartTick = NowTick64();
+		InterlockedIncrement(&g_lRunningCount);
+		g_nTaskCount++;
+		InterlockedExchange(&g_bTextDirty, 1);
+		return TRUE;
+	}
+
 	t->work = CreateThreadpoolWork(WorkCallback, t, &g_callEnv);
 	if (t->work) {
 		InterlockedIncrement(&g_lRunningCount);
@@ -601,10 +3331,831 @@ static void AddOneFile_Locked(const WCHAR* path, BOOL bMD5, BOOL bSHA)
 		g_nTaskCount++;
 
 		InterlockedExchange(&g_bTextDirty, 1);
+		return TRUE;
+	}
+	InterlockedAdd64(&g_llTotalBytesAll, -(LONGLONG)initSize);
+	return FALSE;
+}
+
+// 已完成的任务原地重算（监视模式）：结果清空，复用同一个 work 对象再提交一次
+static void RequeueTask_Locked(FILE_HASH_TASK* t)
+{
+	if (!t->work && !t->bRemote) return;
+
+	// 不清 g_lCancelAll：监视/服务线程不能替调用方撤销 HT_CancelAll
+	EnsureOverallStart();
+
+	// 上一轮已全部完成：done 先对齐 total，再把本次大小计入 total
+	if (InterlockedCompareExchange(&g_lRunningCount, 0, 0) == 0) {
+		LONGLONG total = InterlockedCompareExchange64(&g_llTotalBytesAll, 0, 0);
+		InterlockedExchange64(&g_llDoneBytesAll, total);
+	}
+
+	ULONGLONG initSize = t->ullFileSize;
+	WIN32_FILE_ATTRIBUTE_DATA fad = { 0 };
+	if (GetFileAttributesExW(t->szFilePath, GetFileExInfoStandard, &fad)) {
+		ULARGE_INTEGER u; u.LowPart = fad.nFileSizeLow; u.HighPart = fad.nFileSizeHigh;
+		initSize = u.QuadPart;
+		t->ftModify = fad.ftLastWriteTime;
+	}
+	t->ullFileSizeInit = initSize;
+	t->ullFileSize = initSize;
+	InterlockedAdd64(&g_llTotalBytesAll, (LONGLONG)initSize);
+
+	t->szMD5Value[0] = L'\0';
+	t->szSHA256Value[0] = L'\0';
+	t->bSuccessMD5 = FALSE;
+	t->bSuccessSHA256 = FALSE;
+	t->ullStartTick = 0;
+	t->ullEndTick = 0;
+	InterlockedExchange(&t->bCanceled, 0);
+	InterlockedExchange64(&t->llDoneBytes, 0);
+	InterlockedExchange(&t->lLastUiPctNotified, -1);
+	InterlockedExchange(&t->lExportGen, 0); // 实时导出时再写一条新结果
+	t->ullSparseBytes = 0;
+	InterlockedExchange(&t->bFinished, 0);
+
+	InterlockedIncrement(&g_lRunningCount);
+	if (t->bRemote) {
+		// 重新发给服务；服务按大小/修改时间判断缓存是否失效
+		t->ullStartTick = NowTick64();
+		t->bRemoteSent = FALSE;
+		InterlockedExchange(&t->lRemoteDone, 0);
+	}
+	else {
+		SubmitThreadpoolWork(t->work);
+	}
+	InterlockedExchange(&g_bTextDirty, 1);
+}
+
+// 添加前的计数准备：空表 = 新批次清零，否则上一轮已完成时 done 先对齐 total
+static void BatchPrepare_Locked(void)
+{
+	// 新批次：清零计数（保持你原 StartFiles 行为）
+	if (g_nTaskCount == 0) {
+		InterlockedExchange64(&g_llDoneBytesAll, 0);
+		InterlockedExchange64(&g_llTotalBytesAll, 0);
+		InterlockedExchange64(&g_llSparseBytesAll, 0);
+		MemResetPeak();
+		g_ullOverallStartTick = NowTick64();
+	}
+	else {
+		// 追加：若上一轮已完成，将 done 对齐 total
+		if (InterlockedCompareExchange(&g_lRunningCount, 0, 0) == 0) {
+			LONGLONG total = InterlockedCompareExchange64(&g_llTotalBytesAll, 0, 0);
+			InterlockedExchange64(&g_llDoneBytesAll, total);
+		}
+	}
+}
+
+static BOOL AddTask(const wchar_t* path, BOOL md5, BOOL sha256, const wchar_t* dest, BOOL verify)
+{
+	if (!path || !path[0]) return FALSE;
+	if (!md5 && !sha256) return FALSE;
+
+	EnsureThreadPool();
+	if (!g_pool) return FALSE;
+
+	// 转发给服务时统一成完整路径，回填按路径对应
+	WCHAR full[MAX_PATH];
+	if (!dest && SvcConnActive()) {
+		DWORD n = GetFullPathNameW(path, _countof(full), full, NULL);
+		if (n == 0 || n >= _countof(full)) return FALSE;
+		path = full;
+	}
+
+	EnsureOverallStart();
+
+	EnterCriticalSection(&g_csTasks);
+	BatchPrepare_Locked();
+	BOOL added = AddOneFile_Locked(path, md5, sha256, dest, verify);
+
+	LeaveCriticalSection(&g_csTasks);
+
+	SvcConnSendPending();
+	MarkTextDirtyAndRequest();
+	return added;
+}
+
+// ---------------- 监视模式（目录变更 → 增量重算） ----------------
+// 单独一个线程等待各目录的 ReadDirectoryChangesW；同一路径的事件合并，
+// 静默 debounce 毫秒后才提交：已有任务原地重算，否则新建任务。
+#define MAX_WATCH 16
+static const DWORD WATCH_BUF_SIZE = 64 * 1024;
+static const DWORD WATCH_DEFAULT_DEBOUNCE_MS = 500;
+static const DWORD WATCH_NOTIFY_FILTER =
+	FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE;
+
+typedef struct {
+	WCHAR  szDir[MAX_PATH];
+	HANDLE hDir;
+	OVERLAPPED ov;
+	BYTE*  buf;
+	BOOL   bArmed;             // 监视线程已发起读取
+	BOOL   bRecursive;
+	BOOL   bMD5, bSHA;
+	DWORD  dwDebounceMs;
+} WATCH_DIR;
+
+typedef struct {
+	WCHAR szPath[MAX_PATH];
+	ULONGLONG ullLastTick;     // 最近一次事件
+	DWORD dwDebounceMs;
+	BOOL  bMD5, bSHA;
+} WATCH_PENDING;
+
+static CRITICAL_SECTION g_csWatch;
+static WATCH_DIR g_Watch[MAX_WATCH];
+static int g_nWatch = 0;
+static WATCH_PENDING g_WatchPending[MAX_TASKS]; // 只有监视线程访问
+static int g_nWatchPending = 0;
+static HANDLE g_hWatchThread = NULL;
+static HANDLE g_hWatchWake = NULL;             // 新增目录/停止
+static volatile LONG g_lWatchStop = 0;
+
+static BOOL ExportIsOwnTemp(const WCHAR* base);
+
+// 自己产生的旁路/临时文件不触发重算，否则分块清单写在源旁边会自激。
+// .tmp 只忽略本引擎写的（旁路文件、复制目标、导出），用户自己的 .tmp 照常哈希
+static BOOL WatchIgnored(const WCHAR* path)
+{
+	if (EndsWithI(path, L".htcm") || EndsWithI(path, L".htpc") ||
+		EndsWithI(path, L".htcm.tmp") || EndsWithI(path, L".htpc.tmp")) return TRUE;
+	if (!EndsWithI(path, L".tmp")) return FALSE;
+
+	WCHAR base[MAX_PATH];
+	if (FAILED(StringCchCopyNW(base, _countof(base), path, wcslen(path) - 4))) return FALSE;
+
+	BOOL own = FALSE;
+	EnterCriticalSection(&g_csTasks);
+	for (int i = 0; i < g_nTaskCount && !own; i++) own = (_wcsicmp(g_Tasks[i].szCopyDest, base) == 0);
+	LeaveCriticalSection(&g_csTasks);
+	return own || ExportIsOwnTemp(base);
+}
+
+static void WatchNote(const WATCH_DIR* w, const WCHAR* path)
+{
+	if (WatchIgnored(path)) return;
+
+	ULONGLONG now = NowTick64();
+	for (int i = 0; i < g_nWatchPending; i++) {
+		if (_wcsicmp(g_WatchPending[i].szPath, path) == 0) {
+			g_WatchPending[i].ullLastTick = now; // 合并：重新计时
+			return;
+		}
+	}
+	if (g_nWatchPending >= (int)_countof(g_WatchPending)) return;
+
+	WATCH_PENDING* p = &g_WatchPending[g_nWatchPending];
+	if (FAILED(StringCchCopyW(p->szPath, _countof(p->szPath), path))) return;
+	p->ullLastTick = now;
+	p->dwDebounceMs = w->dwDebounceMs;
+	p->bMD5 = w->bMD5;
+	p->bSHA = w->bSHA;
+	g_nWatchPending++;
+}
+
+// 缓冲溢出时丢失了具体事件：该目录下已有的任务全部重算
+static void WatchNoteAllUnder(const WATCH_DIR* w)
+{
+	size_t n = wcslen(w->szDir);
+	WCHAR path[MAX_PATH];
+
+	for (int i = 0;; i++) {
+		BOOL have = FALSE;
+		EnterCriticalSection(&g_csTasks);
+		if (i < g_nTaskCount) have = SUCCEEDED(StringCchCopyW(path, _countof(path), g_Tasks[i].szFilePath));
+		LeaveCriticalSection(&g_csTasks);
+		if (!have) break;
+
+		if (_wcsnicmp(path, w->szDir, n) == 0 && (path[n] == L'\\' || w->szDir[n - 1] == L'\\')) {
+			if (w->bRecursive || !wcschr(path + n + 1, L'\\')) WatchNote(w, path);
+		}
+	}
+}
+
+static void WatchArm(WATCH_DIR* w)
+{
+	ResetEvent(w->ov.hEvent);
+	w->bArmed = ReadDirectoryChangesW(w->hDir, w->buf, WATCH_BUF_SIZE, w->bRecursive,
+		WATCH_NOTIFY_FILTER, NULL, &w->ov, NULL);
+}
+
+static void WatchCollect(WATCH_DIR* w)
+{
+	DWORD cb = 0;
+	w->bArmed = FALSE;
+	if (!GetOverlappedResult(w->hDir, &w->ov, &cb, FALSE)) return; // 目录被删等：不再监视
+	if (cb == 0) {
+		WatchNoteAllUnder(w);
+	}
+	else {
+		const BYTE* p = w->buf;
+		for (;;) {
+			const FILE_NOTIFY_INFORMATION* fi = (const FILE_NOTIFY_INFORMATION*)p;
+			if (fi->Action == FILE_ACTION_ADDED || fi->Action == FILE_ACTION_MODIFIED ||
+				fi->Action == FILE_ACTION_RENAMED_NEW_NAME) {
+				WCHAR path[MAX_PATH];
+				int cch = (int)(fi->FileNameLength / sizeof(WCHAR));
+				if (SUCCEEDED(StringCchPrintfW(path, _countof(path), L"%s%s%.*s", w->szDir,
+					(w->szDir[wcslen(w->szDir) - 1] == L'\\') ? L"" : L"\\", cch, fi->FileName))) {
+					WatchNote(w, path);
+				}
+			}
+			if (fi->NextEntryOffset == 0) break;
+			p += fi->NextEntryOffset;
+		}
+	}
+	WatchArm(w);
+}
+
+// 返回 FALSE = 任务还在排队/计算，留待下次（届时再合并提交一次）
+static BOOL WatchSubmit(const WATCH_PENDING* p)
+{
+	DWORD attr = GetFileAttributesW(p->szPath);
+	if (attr == INVALID_FILE_ATTRIBUTES || (attr & FILE_ATTRIBUTE_DIRECTORY)) return TRUE; // 已删除/目录
+
+	// HT_CancelAll 之后不再重算：留在待提交队列里，等调用方再次添加工作
+	if (InterlockedCompareExchange(&g_lCancelAll, 0, 0) != 0) return FALSE;
+
+	BOOL done = TRUE;
+	EnterCriticalSection(&g_csTasks);
+	FILE_HASH_TASK* t = FindTask_Locked(p->szPath, NULL);
+	if (t) {
+		if (InterlockedCompareExchange(&t->bFinished, 0, 0) != 0) {
+			// 按本次监视的算法重算
+			t->bCalcMD5 = p->bMD5;
+			t->bCalcSHA256 = p->bSHA;
+			RequeueTask_Locked(t);
+		}
+		else done = FALSE;
+	}
+	LeaveCriticalSection(&g_csTasks);
+
+	// 任务表已满：留在待提交队列里，HT_ClearAll 腾出位置后再提交
+	if (!t) return AddTask(p->szPath, p->bMD5, p->bSHA, NULL, FALSE);
+	if (done) {
+		SvcConnSendPending();
+		MarkTextDirtyAndRequest();
+	}
+	return done;
+}
+
+// 提交已静默够久的路径；返回距下一个到期的毫秒数（INFINITE = 没有待提交）
+static DWORD WatchFlushDue(void)
+{
+	ULONGLONG now = NowTick64();
+	DWORD wait = INFINITE;
+
+	for (int i = 0; i < g_nWatchPending;) {
+		WATCH_PENDING* p = &g_WatchPending[i];
+		ULONGLONG due = p->ullLastTick + p->dwDebounceMs;
+		if (now >= due) {
+			if (WatchSubmit(p)) {
+				g_WatchPending[i] = g_WatchPending[--g_nWatchPending];
+				continue;
+			}
+			p->ullLastTick = now; // 任务忙：再等一个 debounce 周期
+			due = now + p->dwDebounceMs;
+		}
+		if (due - now < wait) wait = (DWORD)(due - now);
+		i++;
+	}
+	return wait;
+}
+
+static DWORD WINAPI WatchThreadProc(LPVOID param)
+{
+	(void)param;
+	HANDLE hs[1 + MAX_WATCH];
+	int idx[1 + MAX_WATCH];
+
+	while (InterlockedCompareExchange(&g_lWatchStop, 0, 0) == 0) {
+		DWORD n = 0;
+		hs[n++] = g_hWatchWake;
+
+		EnterCriticalSection(&g_csWatch);
+		for (int i = 0; i < g_nWatch; i++) {
+			if (!g_Watch[i].bArmed && g_Watch[i].hDir != INVALID_HANDLE_VALUE) WatchArm(&g_Watch[i]);
+			if (g_Watch[i].bArmed) {
+				idx[n] = i;
+				hs[n++] = g_Watch[i].ov.hEvent;
+			}
+		}
+		LeaveCriticalSection(&g_csWatch);
+
+		DWORD r = WaitForMultipleObjects(n, hs, FALSE, WatchFlushDue());
+		if (r > WAIT_OBJECT_0 && r < WAIT_OBJECT_0 + n) {
+			EnterCriticalSection(&g_csWatch);
+			WatchCollect(&g_Watch[idx[r - WAIT_OBJECT_0]]);
+			LeaveCriticalSection(&g_csWatch);
+		}
+	}
+
+	// 读取由本线程发起，也由本线程取消
+	EnterCriticalSection(&g_csWatch);
+	for (int i = 0; i < g_nWatch; i++) {
+		WATCH_DIR* w = &g_Watch[i];
+		if (w->bArmed) {
+			DWORD cb = 0;
+			CancelIo(w->hDir);
+			GetOverlappedResult(w->hDir, &w->ov, &cb, TRUE);
+		}
+		if (w->hDir != INVALID_HANDLE_VALUE) CloseHandle(w->hDir);
+		if (w->ov.hEvent) CloseHandle(w->ov.hEvent);
+		if (w->buf) HeapFree(GetProcessHeap(), 0, w->buf);
+	}
+	ZeroMemory(g_Watch, sizeof(g_Watch));
+	g_nWatch = 0;
+	g_nWatchPending = 0;
+	LeaveCriticalSection(&g_csWatch);
+	return 0;
+}
+
+static void WatchStop(void)
+{
+	if (!g_hWatchThread) return;
+	InterlockedExchange(&g_lWatchStop, 1);
+	SetEvent(g_hWatchWake);
+	WaitForSingleObject(g_hWatchThread, INFINITE);
+	CloseHandle(g_hWatchThread);
+	g_hWatchThread = NULL;
+	CloseHandle(g_hWatchWake);
+	g_hWatchWake = NULL;
+}
+
+// ---------------- 本机哈希服务（命名管道） ----------------
+// 服务进程独占引擎、线程池与结果缓存（g_Tasks），其他进程经命名管道提交请求：
+// 缓存命中（大小与修改时间未变）立即回复；同一文件正在计算时只挂等待位，算完推给所有等待者。
+// 任务表满时淘汰最久未被请求、已完成且无人等待的条目，原地换成新文件重算。
+// 客户端连上服务后 HT_AddFile 转为转发请求，结果回填本地任务表，其余 API 照常使用。
+#define SVC_MAX_CLIENTS 32               // lSvcWaiters 每位对应一个客户端槽
+#define SVC_MAGIC_REQ 0x51525448         // 'HTRQ'
+#define SVC_MAGIC_RES 0x53525448         // 'HTRS'
+#define SVC_OP_HASH 1
+#define SVC_OP_STOP 2
+#define SVC_ST_OK     0
+#define SVC_ST_FAILED 1
+#define SVC_ST_BUSY   2                  // 任务表全部在算/有人等待，或客户端槽已满
+static const WCHAR SVC_DEFAULT_PIPE[] = L"\\\\.\\pipe\\HashTool.Core";
+static const DWORD SVC_PIPE_BUF = 64 * 1024;
+
+#pragma pack(push, 1)
+typedef struct {
+	DWORD dwMagic;
+	DWORD dwOp;
+	DWORD dwSeq;                         // 客户端自增序号，原样回显在 SVC_RESULT 里
+	BOOL  bMD5, bSHA;
+	WCHAR szPath[MAX_PATH];              // 完整路径
+} SVC_REQUEST;
+
+// 结果按完成顺序推送，用 dwSeq + szPath 对应请求；同一客户端对同一文件的重复请求合并为一条，
+// 回显最后一次请求的序号
+typedef struct {
+	DWORD dwMagic;
+	DWORD dwSeq;
+	DWORD dwStatus;                      // SVC_ST_*
+	ULONGLONG ullSize;
+	FILETIME ftModify;
+	BOOL  bMD5, bSHA;                    // 对应摘要有效
+	WCHAR szMD5[33];
+	WCHAR szSHA256[65];
+	WCHAR szPath[MAX_PATH];
+} SVC_RESULT;
+#pragma pack(pop)
+
+typedef struct {
+	BOOL   bUsed;
+	HANDLE hPipe;
+	HANDLE hThread;
+	HANDLE hQueued;                      // 自动重置：推送队列非空
+	HANDLE hWrite;                       // 写入用事件
+	SVC_RESULT* q;                       // 待推送结果的快照（任务槽可能被淘汰复用，不能只记下标）
+	int    qHead, qCount;
+	BOOL   bOverflow;                    // 队列溢出：客户端读得太慢，断开它
+} SVC_CLIENT;
+
+#define SVC_QUEUE_LEN MAX_TASKS          // 每个任务至多一项待推送，正常情况下不会溢出
+
+// 锁顺序：g_csTasks → g_csSvc
+static CRITICAL_SECTION g_csSvc;
+static SVC_CLIENT g_SvcClients[SVC_MAX_CLIENTS];
+static HANDLE g_hSvcStop = NULL;             // HT_Init 创建、HT_Shutdown 关闭；只在 g_csSvc 内复位/置位
+static volatile LONG g_lSvcRunning = 0;     // g_csSvc 内改动
+
+// 瘦客户端一侧
+static CRITICAL_SECTION g_csSvcConn;     // 串行化请求写入
+static HANDLE g_hSvcConn = INVALID_HANDLE_VALUE;
+static HANDLE g_hSvcConnThread = NULL;
+static HANDLE g_hSvcConnStop = NULL;
+static HANDLE g_hSvcConnWrite = NULL;
+static volatile LONG g_lSvcConnected = 0;
+static volatile LONG g_lSvcSeq = 0;      // 请求序号；0 留给与请求无关的回复（如槽位已满）
+
+static BOOL SvcWrite(HANDLE h, HANDLE hEvent, const void* p, DWORD cb)
+{
+	OVERLAPPED ov;
+	DWORD put = 0;
+	ZeroMemory(&ov, sizeof(ov));
+	ov.hEvent = hEvent;
+	if (!WriteFile(h, p, cb, NULL, &ov) && GetLastError() != ERROR_IO_PENDING) return FALSE;
+	return GetOverlappedResult(h, &ov, &put, TRUE) && put == cb;
+}
+
+static void SvcFillResult_Locked(const FILE_HASH_TASK* t, SVC_RESULT* r)
+{
+	ZeroMemory(r, sizeof(*r));
+	r->dwMagic = SVC_MAGIC_RES;
+	r->ullSize = t->ullFileSize;
+	r->ftModify = t->ftModify;
+	r->bMD5 = t->bCalcMD5 && t->bSuccessMD5;
+	r->bSHA = t->bCalcSHA256 && t->bSuccessSHA256;
+	r->dwStatus = (r->bMD5 || r->bSHA) ? SVC_ST_OK : SVC_ST_FAILED;
+	if (r->bMD5) StringCchCopyW(r->szMD5, _countof(r->szMD5), t->szMD5Value);
+	if (r->bSHA) StringCchCopyW(r->szSHA256, _countof(r->szSHA256), t->szSHA256Value);
+	StringCchCopyW(r->szPath, _countof(r->szPath), t->szFilePath);
+}
+
+// 已完成、含所需摘要，且文件大小与修改时间都没变
+static BOOL SvcCacheFresh_Locked(const FILE_HASH_TASK* t, const SVC_REQUEST* rq)
+{
+	if (t->bCanceled) return FALSE;
+	if (rq->bMD5 && !(t->bCalcMD5 && t->bSuccessMD5)) return FALSE;
+	if (rq->bSHA && !(t->bCalcSHA256 && t->bSuccessSHA256)) return FALSE;
+
+	WIN32_FILE_ATTRIBUTE_DATA fad = { 0 };
+	if (!GetFileAttributesExW(t->szFilePath, GetFileExInfoStandard, &fad)) return FALSE;
+	ULARGE_INTEGER u; u.LowPart = fad.nFileSizeLow; u.HighPart = fad.nFileSizeHigh;
+	return u.QuadPart == t->ullFileSize && CompareFileTime(&fad.ftLastWriteTime, &t->ftModify) == 0;
+}
+
+// 由 FinishTask 在 g_csTasks 内、发布 bFinished 之前调用：把任务推给所有等待它的客户端
+static void ServiceOnTaskFinished_Locked(FILE_HASH_TASK* t)
+{
+	if (InterlockedCompareExchange(&g_lSvcRunning, 0, 0) == 0) return;
+
+	ULONG w = (ULONG)InterlockedExchange(&t->lSvcWaiters, 0);
+	if (w) {
+		SVC_RESULT r;
+		SvcFillResult_Locked(t, &r);
+		EnterCriticalSection(&g_csSvc);
+		for (int i = 0; i < SVC_MAX_CLIENTS; i++) {
+			SVC_CLIENT* c = &g_SvcClients[i];
+			if (!((w >> i) & 1) || !c->bUsed) continue;
+			r.dwSeq = t->adwSvcSeq[i];
+			if (c->qCount >= SVC_QUEUE_LEN) c->bOverflow = TRUE;
+			else c->q[(c->qHead + c->qCount++) % SVC_QUEUE_LEN] = r;
+			SetEvent(c->hQueued);
+		}
+		LeaveCriticalSection(&g_csSvc);
+	}
+}
+
+// 任务表已满：挑最久未被请求的已完成、无人等待的本地任务，原地换成 path 重算。
+// 复制任务与远程任务不动；work 对象跟着槽位走，回调仍拿同一个任务指针。
+static FILE_HASH_TASK* SvcReuseSlot_Locked(const WCHAR* path)
+{
+	FILE_HASH_TASK* lru = NULL;
+	for (int i = 0; i < g_nTaskCount; i++) {
+		FILE_HASH_TASK* t = &g_Tasks[i];
+		if (!t->work || t->bRemote || t->szCopyDest[0]) continue;
+		if (InterlockedCompareExchange(&t->bFinished, 0, 0) == 0 || t->lSvcWaiters != 0) continue;
+		if (!lru || t->ullSvcLastUse < lru->ullSvcLastUse) lru = t;
+	}
+	if (!lru) return NULL;
+
+	ArchiveFreeMembers_Locked(lru);
+	StringCchCopyW(lru->szFilePath, _countof(lru->szFilePath), path);
+	lru->szFileVersion[0] = L'\0';
+	lru->bCalcMD5 = TRUE;
+	lru->bCalcSHA256 = TRUE;
+	RequeueTask_Locked(lru);
+	return lru;
+}
+
+// 所有文件都同时算 MD5 与 SHA-256，缓存可服务任意组合的请求
+static BOOL SvcHandleRequest(SVC_CLIENT* c, int ci, const SVC_REQUEST* rq)
+{
+	SVC_RESULT r;
+	WCHAR full[MAX_PATH];
+	BOOL reply = TRUE;
+
+	ZeroMemory(&r, sizeof(r));
+	r.dwMagic = SVC_MAGIC_RES;
+	r.dwSeq = rq->dwSeq;
+	r.dwStatus = SVC_ST_FAILED;
+	StringCchCopyW(r.szPath, _countof(r.szPath), rq->szPath);
+
+	DWORD n = GetFullPathNameW(rq->szPath, _countof(full), full, NULL);
+	if (n == 0 || n >= _countof(full) || (!rq->bMD5 && !rq->bSHA)) {
+		return SvcWrite(c->hPipe, c->hWrite, &r, sizeof(r));
+	}
+
+	EnterCriticalSection(&g_csTasks);
+	FILE_HASH_TASK* t = FindTask_Locked(full, NULL);
+	if (t && InterlockedCompareExchange(&t->bFinished, 0, 0) == 0) {
+		reply = FALSE; // 正在计算：合并到同一任务
+	}
+	else if (t && SvcCacheFresh_Locked(t, rq)) {
+		SvcFillResult_Locked(t, &r);
+		r.dwSeq = rq->dwSeq;
+	}
+	else if (t) {
+		if (t->work) {
+			t->bCalcMD5 = TRUE;
+			t->bCalcSHA256 = TRUE;
+			RequeueTask_Locked(t);
+			reply = FALSE;
+		}
 	}
 	else {
-		InterlockedAdd64(&g_llTotalBytesAll, -(LONGLONG)initSize);
+		// 直接入表，不经 AddTask：客户端请求不能碰取消标志，也不走瘦客户端转发
+		EnsureOverallStart();
+		BatchPrepare_Locked();
+		if (AddOneFile_Locked(full, TRUE, TRUE, NULL, FALSE)) t = FindTask_Locked(full, NULL);
+		if (!t) t = SvcReuseSlot_Locked(full);
+		if (t) reply = FALSE;
+		else r.dwStatus = SVC_ST_BUSY;
+	}
+	if (t) t->ullSvcLastUse = NowTick64();
+	// 持有 g_csTasks 时挂等待位：FinishTask 在同一把锁内取走等待位并发布 bFinished，不会漏推
+	if (!reply) {
+		t->adwSvcSeq[ci] = rq->dwSeq;
+		InterlockedOr(&t->lSvcWaiters, (LONG)(1UL << ci));
+	}
+	LeaveCriticalSection(&g_csTasks);
+
+	return reply ? SvcWrite(c->hPipe, c->hWrite, &r, sizeof(r)) : TRUE;
+}
+
+static BOOL SvcFlushQueue(SVC_CLIENT* c)
+{
+	for (;;) {
+		SVC_RESULT r;
+		EnterCriticalSection(&g_csSvc);
+		if (c->bOverflow) {
+			LeaveCriticalSection(&g_csSvc);
+			return FALSE;
+		}
+		if (c->qCount == 0) {
+			LeaveCriticalSection(&g_csSvc);
+			return TRUE;
+		}
+		r = c->q[c->qHead];
+		c->qHead = (c->qHead + 1) % SVC_QUEUE_LEN;
+		c->qCount--;
+		LeaveCriticalSection(&g_csSvc);
+
+		if (!SvcWrite(c->hPipe, c->hWrite, &r, sizeof(r))) return FALSE;
+	}
+}
+
+// 客户端断开：清掉它在各任务上的等待位，释放槽位
+static void SvcClientDetach(int ci)
+{
+	SVC_CLIENT* c = &g_SvcClients[ci];
+	LONG mask = ~(LONG)(1UL << ci);
+
+	EnterCriticalSection(&g_csTasks);
+	for (int i = 0; i < g_nTaskCount; i++) InterlockedAnd(&g_Tasks[i].lSvcWaiters, mask);
+	EnterCriticalSection(&g_csSvc);
+	DisconnectNamedPipe(c->hPipe);
+	CloseHandle(c->hPipe);
+	c->hPipe = INVALID_HANDLE_VALUE;
+	c->qHead = c->qCount = 0;
+	c->bOverflow = FALSE;
+	c->bUsed = FALSE;
+	LeaveCriticalSection(&g_csSvc);
+	LeaveCriticalSection(&g_csTasks);
+}
+
+static DWORD WINAPI SvcClientThreadProc(LPVOID param)
+{
+	int ci = (int)(INT_PTR)param;
+	SVC_CLIENT* c = &g_SvcClients[ci];
+	SVC_REQUEST rq;
+	OVERLAPPED ov;
+	DWORD got = 0;
+	BOOL reading = FALSE;
+
+	ZeroMemory(&ov, sizeof(ov));
+	ov.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	if (!ov.hEvent) goto done;
+
+	for (;;) {
+		if (!reading) {
+			ZeroMemory(&rq, sizeof(rq));
+			if (!ReadFile(c->hPipe, &rq, sizeof(rq), NULL, &ov) && GetLastError() != ERROR_IO_PENDING) break;
+			reading = TRUE;
+		}
+
+		HANDLE hs[3] = { ov.hEvent, c->hQueued, g_hSvcStop };
+		DWORD w = WaitForMultipleObjects(3, hs, FALSE, INFINITE);
+		if (w == WAIT_OBJECT_0) {
+			reading = FALSE;
+			// 断开、消息过长或格式不对都直接断开
+			if (!GetOverlappedResult(c->hPipe, &ov, &got, FALSE)) break;
+			if (got != sizeof(rq) || rq.dwMagic != SVC_MAGIC_REQ) break;
+			rq.szPath[MAX_PATH - 1] = L'\0';
+
+			if (rq.dwOp == SVC_OP_STOP) {
+				SetEvent(g_hSvcStop);
+				break;
+			}
+			if (rq.dwOp == SVC_OP_HASH && !SvcHandleRequest(c, ci, &rq)) break;
+		}
+		else if (w == WAIT_OBJECT_0 + 1) {
+			if (!SvcFlushQueue(c)) break;
+		}
+		else {
+			break;
+		}
+	}
+
+	if (reading) {
+		CancelIoEx(c->hPipe, &ov);
+		GetOverlappedResult(c->hPipe, &ov, &got, TRUE);
+	}
+	CloseHandle(ov.hEvent);
+done:
+	SvcClientDetach(ci);
+	return 0;
+}
+
+// 为已连接的管道实例分配客户端槽；失败时管道仍归调用方
+static BOOL SvcAttach(HANDLE hPipe)
+{
+	int ci = -1;
+	EnterCriticalSection(&g_csSvc);
+	for (int i = 0; i < SVC_MAX_CLIENTS; i++) {
+		if (!g_SvcClients[i].bUsed) { ci = i; break; }
+	}
+	if (ci >= 0) {
+		SVC_CLIENT* c = &g_SvcClients[ci];
+		c->bUsed = TRUE;
+		c->hPipe = hPipe;
+		c->qHead = c->qCount = 0;
+		c->bOverflow = FALSE;
+		ResetEvent(c->hQueued);
+	}
+	LeaveCriticalSection(&g_csSvc);
+	if (ci < 0) return FALSE;
+
+	// 上一个使用该槽的线程已释放槽位，只差退出
+	SVC_CLIENT* c = &g_SvcClients[ci];
+	if (c->hThread) {
+		WaitForSingleObject(c->hThread, INFINITE);
+		CloseHandle(c->hThread);
+	}
+	c->hThread = CreateThread(NULL, 0, SvcClientThreadProc, (LPVOID)(INT_PTR)ci, 0, NULL);
+	if (!c->hThread) {
+		EnterCriticalSection(&g_csSvc);
+		c->hPipe = INVALID_HANDLE_VALUE;
+		c->bUsed = FALSE;
+		LeaveCriticalSection(&g_csSvc);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// ---- 瘦客户端：HT_AddFile 转发，结果回填本地任务 ----
+static BOOL SvcConnActive(void)
+{
+	return InterlockedCompareExchange(&g_lSvcConnected, 0, 0) != 0;
+}
+
+// 未收尾的远程任务全部收尾（取消或连接断开）；与回填竞争时以 lRemoteDone 为准
+static void SvcConnFinishPending(BOOL bCanceled)
+{
+	FILE_HASH_TASK* list[MAX_TASKS];
+	int n = 0;
+
+	EnterCriticalSection(&g_csTasks);
+	for (int i = 0; i < g_nTaskCount; i++) {
+		FILE_HASH_TASK* t = &g_Tasks[i];
+		if (!t->bRemote || InterlockedCompareExchange(&t->lRemoteDone, 1, 0) != 0) continue;
+		if (bCanceled) InterlockedExchange(&t->bCanceled, 1);
+		list[n++] = t;
+	}
+	LeaveCriticalSection(&g_csTasks);
+
+	for (int i = 0; i < n; i++) FinishTask(list[i]);
+}
+
+// 发送尚未发出的远程请求；不持有 g_csTasks 写管道，避免与回填线程互等
+static void SvcConnSendPending(void)
+{
+	while (SvcConnActive()) {
+		SVC_REQUEST rq;
+		FILE_HASH_TASK* t = NULL;
+
+		ZeroMemory(&rq, sizeof(rq));
+		EnterCriticalSection(&g_csTasks);
+		for (int i = 0; i < g_nTaskCount; i++) {
+			if (g_Tasks[i].bRemote && !g_Tasks[i].bRemoteSent) { t = &g_Tasks[i]; break; }
+		}
+		if (t) {
+			t->bRemoteSent = TRUE;
+			do t->dwRemoteSeq = (DWORD)InterlockedIncrement(&g_lSvcSeq); while (t->dwRemoteSeq == 0);
+			rq.dwMagic = SVC_MAGIC_REQ;
+			rq.dwOp = SVC_OP_HASH;
+			rq.dwSeq = t->dwRemoteSeq;
+			rq.bMD5 = t->bCalcMD5;
+			rq.bSHA = t->bCalcSHA256;
+			StringCchCopyW(rq.szPath, _countof(rq.szPath), t->szFilePath);
+		}
+		LeaveCriticalSection(&g_csTasks);
+		if (!t) return;
+
+		EnterCriticalSection(&g_csSvcConn);
+		BOOL ok = g_hSvcConn != INVALID_HANDLE_VALUE && SvcWrite(g_hSvcConn, g_hSvcConnWrite, &rq, sizeof(rq));
+		LeaveCriticalSection(&g_csSvcConn);
+
+		if (!ok && InterlockedCompareExchange(&t->lRemoteDone, 1, 0) == 0) FinishTask(t);
+	}
+}
+
+static void SvcConnDeliver(const SVC_RESULT* r)
+{
+	EnterCriticalSection(&g_csTasks);
+	FILE_HASH_TASK* t = FindTask_Locked(r->szPath, NULL);
+	// 序号不符 = 重算前那一轮的迟到回复，或服务端回错了，丢弃并继续等本轮的结果
+	if (t && (!t->bRemote || !t->bRemoteSent || t->dwRemoteSeq != r->dwSeq)) t = NULL;
+	if (t && InterlockedCompareExchange(&t->lRemoteDone, 1, 0) != 0) t = NULL; // 已取消/重复
+	if (t && r->dwStatus == SVC_ST_OK) {
+		if (t->bCalcMD5 && r->bMD5) {
+			StringCchCopyW(t->szMD5Value, _countof(t->szMD5Value), r->szMD5);
+			t->bSuccessMD5 = TRUE;
+		}
+		if (t->bCalcSHA256 && r->bSHA) {
+			StringCchCopyW(t->szSHA256Value, _countof(t->szSHA256Value), r->szSHA256);
+			t->bSuccessSHA256 = TRUE;
+		}
+		t->ftModify = r->ftModify;
+
+		// total 以服务端实际大小为准，done 一次补齐
+		InterlockedAdd64(&g_llTotalBytesAll, (LONGLONG)r->ullSize - (LONGLONG)t->ullFileSizeInit);
+		t->ullFileSizeInit = r->ullSize;
+		t->ullFileSize = r->ullSize;
+		InterlockedExchange64(&t->llDoneBytes, (LONGLONG)r->ullSize);
+		InterlockedAdd64(&g_llDoneBytesAll, (LONGLONG)r->ullSize);
 	}
+	LeaveCriticalSection(&g_csTasks);
+
+	if (t) FinishTask(t);
+}
+
+static DWORD WINAPI SvcConnReaderProc(LPVOID param)
+{
+	(void)param;
+	SVC_RESULT r;
+	OVERLAPPED ov;
+	DWORD got = 0;
+
+	ZeroMemory(&ov, sizeof(ov));
+	ov.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	while (ov.hEvent) {
+		ZeroMemory(&r, sizeof(r));
+		if (!ReadFile(g_hSvcConn, &r, sizeof(r), NULL, &ov) && GetLastError() != ERROR_IO_PENDING) break;
+
+		HANDLE hs[2] = { ov.hEvent, g_hSvcConnStop };
+		if (WaitForMultipleObjects(2, hs, FALSE, INFINITE) != WAIT_OBJECT_0) {
+			CancelIoEx(g_hSvcConn, &ov);
+			GetOverlappedResult(g_hSvcConn, &ov, &got, TRUE);
+			break;
+		}
+		if (!GetOverlappedResult(g_hSvcConn, &ov, &got, FALSE)) break;
+		if (got != sizeof(r) || r.dwMagic != SVC_MAGIC_RES) break;
+		r.szPath[MAX_PATH - 1] = L'\0';
+		r.szMD5[_countof(r.szMD5) - 1] = L'\0';
+		r.szSHA256[_countof(r.szSHA256) - 1] = L'\0';
+		SvcConnDeliver(&r);
+	}
+	if (ov.hEvent) CloseHandle(ov.hEvent);
+
+	// 服务断开：还没回来的任务记为失败
+	InterlockedExchange(&g_lSvcConnected, 0);
+	SvcConnFinishPending(FALSE);
+	return 0;
+}
+
+static void SvcDisconnect(void)
+{
+	if (!g_hSvcConnThread) return;
+	SetEvent(g_hSvcConnStop);
+	WaitForSingleObject(g_hSvcConnThread, INFINITE);
+	CloseHandle(g_hSvcConnThread);
+	g_hSvcConnThread = NULL;
+
+	EnterCriticalSection(&g_csSvcConn);
+	CloseHandle(g_hSvcConn);
+	g_hSvcConn = INVALID_HANDLE_VALUE;
+	LeaveCriticalSection(&g_csSvcConn);
+
+	CloseHandle(g_hSvcConnStop);
+	g_hSvcConnStop = NULL;
+	CloseHandle(g_hSvcConnWrite);
+	g_hSvcConnWrite = NULL;
 }
 
 // ---------------- 文本构建（由 UI 调用；逻辑与原拼接一致） ----------------
@@ -620,11 +4171,19 @@ static void BuildTextIfDirty_Throttle(BOOL force)
 
 	TASK_SNAPSHOT snap[MAX_TASKS];
 	int nSnap = 0;
+	ARCHIVE_MEMBER* mem = NULL;
+	LONG nMem = 0;
 
 	EnterCriticalSection(&g_csTasks);
 	nSnap = g_nTaskCount;
 	if (nSnap > MAX_TASKS) nSnap = MAX_TASKS;
 
+	for (int i = 0; i < nSnap; i++) {
+		nMem += (g_Tasks[i].nMembers < ARC_TEXT_MAX_MEMBERS) ? g_Tasks[i].nMembers : ARC_TEXT_MAX_MEMBERS;
+	}
+	if (nMem) mem = (ARCHIVE_MEMBER*)HeapAlloc(GetProcessHeap(), 0, (SIZE_T)nMem * sizeof(ARCHIVE_MEMBER));
+	nMem = 0;
+
 	for (int i = 0; i < nSnap; i++) {
 		FILE_HASH_TASK* t = &g_Tasks[i];
 		TASK_SNAPSHOT* s = &snap[i];
@@ -646,11 +4205,35 @@ static void BuildTextIfDirty_Throttle(BOOL force)
 		s->llDoneBytes = InterlockedCompareExchange64(&t->llDoneBytes, 0, 0);
 		s->ullStartTick = t->ullStartTick;
 		s->ullEndTick = t->ullEndTick;
+		s->ullResumedFrom = t->ullResumedFrom;
+		s->bChunkManifest = t->bChunkManifest;
+		s->bChunkOk = t->bChunkOk;
+		s->ullChunkCount = t->ullChunkCount;
+		s->dwPieceSize = t->dwPieceSize;
+		s->bPiecesOk = t->bPiecesOk;
+		s->ullPieceCount = t->ullPieceCount;
+		s->nArchiveKind = t->nArchiveKind;
+		s->bArchiveOk = t->bArchiveOk;
+		s->nMembers = t->nMembers;
+		s->iMemberFirst = nMem;
+		StringCchCopyW(s->szCopyDest, _countof(s->szCopyDest), t->szCopyDest);
+		s->bCopyVerify = t->bCopyVerify;
+		s->bCopyOk = t->bCopyOk;
+		s->nVerifyResult = t->nVerifyResult;
+		s->ullSparseBytes = t->ullSparseBytes;
+		if (mem) {
+			s->nMembersShown = (t->nMembers < ARC_TEXT_MAX_MEMBERS) ? t->nMembers : ARC_TEXT_MAX_MEMBERS;
+			memcpy(mem + nMem, t->pMembers, (size_t)s->nMembersShown * sizeof(ARCHIVE_MEMBER));
+			nMem += s->nMembersShown;
+		}
 	}
 	LeaveCriticalSection(&g_csTasks);
 
-	size_t roughNeed = (size_t)(nSnap ? nSnap : 1) * 1024 + 4096;
-	if (!EnsureTextCapacity(roughNeed)) return;
+	size_t roughNeed = (size_t)(nSnap ? nSnap : 1) * 1024 + (size_t)nMem * 512 + 4096;
+	if (!EnsureTextCapacity(roughNeed)) {
+		if (mem) HeapFree(GetProcessHeap(), 0, mem);
+		return;
+	}
 
 	TextReset();
 	WCHAR* pDst = g_pTextBuf;
@@ -699,6 +4282,18 @@ static void BuildTextIfDirty_Throttle(BOOL force)
 
 		AppendLineDyn(&pDst, &cchRemain, L"文件: %s\r\n", t->szFilePath);
 		AppendLineDyn(&pDst, &cchRemain, L"大小: %s\r\n", sizeStr);
+		if (t->ullResumedFrom && finished) {
+			WCHAR reuseStr[64] = { 0 }, newStr[64] = { 0 };
+			FormatBytes(t->ullResumedFrom, reuseStr, _countof(reuseStr));
+			FormatBytes((ULONGLONG)doneBytes - t->ullResumedFrom, newStr, _countof(newStr));
+			AppendLineDyn(&pDst, &cchRemain, L"增量: 复用 %s，仅哈希新增 %s\r\n", reuseStr, newStr);
+		}
+		if (t->szCopyDest[0]) AppendLineDyn(&pDst, &cchRemain, L"复制到: %s\r\n", t->szCopyDest);
+		if (t->ullSparseBytes && finished) {
+			WCHAR sparseStr[64] = { 0 };
+			FormatBytes(t->ullSparseBytes, sparseStr, _countof(sparseStr));
+			AppendLineDyn(&pDst, &cchRemain, L"稀疏: %s 未分配，直接补零未读盘\r\n", sparseStr);
+		}
 		AppendLineDyn(&pDst, &cchRemain, L"修改时间: %s\r\n", timeStr[0] ? timeStr : L"(未知)");
 		if (t->szFileVersion[0]) AppendLineDyn(&pDst, &cchRemain, L"文件版本: %s\r\n", t->szFileVersion);
 
@@ -712,9 +4307,294 @@ static void BuildTextIfDirty_Throttle(BOOL force)
 			else AppendLineDyn(&pDst, &cchRemain, L"SHA256: %s\r\n",
 				(t->bSuccessSHA256 ? t->szSHA256Value : (canceled ? L"(取消)" : L"(失败)")));
 		}
+		if (t->szCopyDest[0] && finished) {
+			if (t->bCopyOk) {
+				AppendLineDyn(&pDst, &cchRemain, L"复制: 完成%s\r\n", t->bCopyVerify ? L"，无缓冲回读校验一致" : L"");
+			}
+			else if (t->nVerifyResult == COPY_VERIFY_MISMATCH) {
+				AppendLineDyn(&pDst, &cchRemain, L"复制: 回读校验不一致，目标已丢弃\r\n");
+			}
+			else {
+				AppendLineDyn(&pDst, &cchRemain, L"复制: %s\r\n", canceled ? L"(取消)" : L"(失败)");
+			}
+		}
+		if (t->bChunkManifest && finished) {
+			if (t->bChunkOk) AppendLineDyn(&pDst, &cchRemain, L"分块清单: %I64u 块\r\n", t->ullChunkCount);
+			else AppendLineDyn(&pDst, &cchRemain, L"分块清单: %s\r\n", canceled ? L"(取消)" : L"(失败)");
+		}
+		if (t->dwPieceSize && finished) {
+			WCHAR pieceStr[64] = { 0 };
+			FormatBytes(t->dwPieceSize, pieceStr, _countof(pieceStr));
+			if (t->bPiecesOk) AppendLineDyn(&pDst, &cchRemain, L"分片哈希: %I64u 片 × %s\r\n", t->ullPieceCount, pieceStr);
+			else AppendLineDyn(&pDst, &cchRemain, L"分片哈希: %s\r\n", canceled ? L"(取消)" : L"(失败)");
+		}
+		if (t->nArchiveKind && (t->nMembers || finished)) {
+			if (finished && !t->bArchiveOk) {
+				AppendLineDyn(&pDst, &cchRemain, L"归档成员: %d 个（%s）\r\n", t->nMembers, canceled ? L"取消" : L"解析不完整");
+			}
+			else {
+				AppendLineDyn(&pDst, &cchRemain, L"归档成员: %d 个\r\n", t->nMembers);
+			}
+
+			for (LONG k = 0; k < t->nMembersShown; k++) {
+				ARCHIVE_MEMBER* m = &mem[t->iMemberFirst + k];
+				WCHAR memberSize[64] = { 0 };
+				FormatBytes(m->bFinished ? m->ullSize : m->ullExpectSize, memberSize, _countof(memberSize));
+
+				AppendLineDyn(&pDst, &cchRemain, L"  · %s (%s)\r\n", m->szName[0] ? m->szName : L"(无名)", memberSize);
+				if (!m->bFinished) {
+					AppendLineDyn(&pDst, &cchRemain, L"    正在计算...\r\n");
+				}
+				else if (!m->bSuccess) {
+					AppendLineDyn(&pDst, &cchRemain, L"    %s\r\n", canceled ? L"(取消)" : L"(失败)");
+				}
+				else {
+					if (t->bCalcMD5) AppendLineDyn(&pDst, &cchRemain, L"    MD5: %s\r\n", m->szMD5Value);
+					if (t->bCalcSHA256) AppendLineDyn(&pDst, &cchRemain, L"    SHA256: %s\r\n", m->szSHA256Value);
+				}
+			}
+			if (t->nMembers > t->nMembersShown) {
+				AppendLineDyn(&pDst, &cchRemain, L"  … 另有 %d 个成员未列出\r\n", t->nMembers - t->nMembersShown);
+			}
+		}
 
 		AppendLineDyn(&pDst, &cchRemain, L"\r\n");
 	}
+
+	if (mem) HeapFree(GetProcessHeap(), 0, mem);
+}
+
+// ---------------- 结果导出（HT_Export） ----------------
+// 只在任务完成时写一条（含其归档成员），经 64KB 缓冲流式落盘，内存占用与任务数无关。
+// 文本格式为 UTF-8；二进制格式见 EXPORT_BIN_*。
+static const DWORD EXPORT_BIN_MAGIC = 0x58455448; // 'HTEX'
+
+#define EXPORT_F_MD5      0x01
+#define EXPORT_F_SHA256   0x02
+#define EXPORT_F_MEMBER   0x04 // 上一条文件记录的归档成员，名称为成员路径
+#define EXPORT_F_CANCELED 0x08
+
+#pragma pack(push, 1)
+typedef struct {
+	DWORD dwMagic;
+	WORD  wVersion;
+	WORD  wReserved;
+	ULONGLONG ullCount;   // 记录数（含成员），关闭时回填
+} EXPORT_BIN_HEADER;
+
+typedef struct {
+	BYTE  bFlags;         // EXPORT_F_*
+	BYTE  bReserved;
+	WORD  cchName;        // 紧随其后的 UTF-16 名称字符数（不含 \0）
+	ULONGLONG ullSize;
+	ULONGLONG ullMtime;   // FILETIME（UTC）；成员为 0
+	BYTE  md5[16];
+	BYTE  sha256[32];
+} EXPORT_BIN_RECORD;
+#pragma pack(pop)
+
+static CRITICAL_SECTION g_csExport;
+static SIDECAR_OUT g_ExportOut;
+static BOOL  g_bExportOpen = FALSE;
+static int   g_nExportFormat = HT_EXPORT_CSV;
+static LONG  g_lExportGen = 0;          // 每次 HT_Export 递增；任务记下自己已写入的批次
+static ULONGLONG g_ullExportRecords = 0;
+
+static void HexToBin(const WCHAR* hex, BYTE* out, DWORD cb)
+{
+	for (DWORD i = 0; i < cb; i++) {
+		BYTE v = 0;
+		for (int k = 0; k < 2; k++) {
+			WCHAR c = hex[i * 2 + k];
+			v = (BYTE)(v << 4);
+			if (c >= L'0' && c <= L'9') v |= (BYTE)(c - L'0');
+			else if (c >= L'A' && c <= L'F') v |= (BYTE)(c - L'A' + 10);
+			else if (c >= L'a' && c <= L'f') v |= (BYTE)(c - L'a' + 10);
+		}
+		out[i] = v;
+	}
+}
+
+// RFC 4180：含逗号、引号或换行时整体加引号，内部引号加倍
+static void CsvField(const WCHAR* src, WCHAR* dst, size_t cch)
+{
+	BOOL quote = (wcspbrk(src, L",\"\r\n") != NULL);
+	size_t n = 0;
+	if (cch < 3) { if (cch) dst[0] = L'\0'; return; }
+	if (quote) dst[n++] = L'"';
+	for (; *src && n + 3 < cch; src++) {
+		if (*src == L'"') dst[n++] = L'"';
+		dst[n++] = *src;
+	}
+	if (quote) dst[n++] = L'"';
+	dst[n] = L'\0';
+}
+
+static void JsonString(const WCHAR* src, WCHAR* dst, size_t cch)
+{
+	size_t n = 0;
+	for (; *src && n + 7 < cch; src++) {
+		WCHAR c = *src;
+		if (c == L'"' || c == L'\\') { dst[n++] = L'\\'; dst[n++] = c; }
+		else if (c < 0x20) { StringCchPrintfW(dst + n, cch - n, L"\\u%04x", (unsigned)c); n += 6; }
+		else dst[n++] = c;
+	}
+	dst[n] = L'\0';
+}
+
+static void FileTimeToIsoUtc(const FILETIME* ft, WCHAR* out, size_t cch)
+{
+	SYSTEMTIME st;
+	out[0] = L'\0';
+	if ((ft->dwLowDateTime || ft->dwHighDateTime) && FileTimeToSystemTime(ft, &st)) {
+		StringCchPrintfW(out, cch, L"%04u-%02u-%02uT%02u:%02u:%02uZ",
+			st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
+	}
+}
+
+// 调用方持有 g_csExport
+static void ExportLine_Locked(const WCHAR* fmt, ...)
+{
+	WCHAR tmp[4096];
+	char  utf8[4096 * 3];
+
+	va_list ap; va_start(ap, fmt);
+	HRESULT hr = StringCchVPrintfW(tmp, _countof(tmp), fmt, ap);
+	va_end(ap);
+	if (FAILED(hr)) { g_ExportOut.bFailed = TRUE; return; }
+
+	int n = WideCharToMultiByte(CP_UTF8, 0, tmp, -1, utf8, (int)sizeof(utf8), NULL, NULL);
+	if (n <= 1) { g_ExportOut.bFailed = TRUE; return; }
+	SidecarWrite(&g_ExportOut, utf8, (DWORD)(n - 1));
+}
+
+static void ExportBin_Locked(BYTE flags, const WCHAR* name, ULONGLONG size, const FILETIME* ft,
+	const WCHAR* md5, const WCHAR* sha)
+{
+	EXPORT_BIN_RECORD r;
+	ZeroMemory(&r, sizeof(r));
+	size_t cch = wcslen(name);
+	if (cch > 0xFFFF) cch = 0xFFFF;
+
+	r.bFlags = flags;
+	r.cchName = (WORD)cch;
+	r.ullSize = size;
+	if (ft) r.ullMtime = ((ULONGLONG)ft->dwHighDateTime << 32) | ft->dwLowDateTime;
+	if (flags & EXPORT_F_MD5) HexToBin(md5, r.md5, sizeof(r.md5));
+	if (flags & EXPORT_F_SHA256) HexToBin(sha, r.sha256, sizeof(r.sha256));
+
+	SidecarWrite(&g_ExportOut, &r, sizeof(r));
+	SidecarWrite(&g_ExportOut, name, (DWORD)(cch * sizeof(WCHAR)));
+}
+
+// 一个条目（文件或成员）；member 为 NULL 时是文件本身
+static void ExportRecord_Locked(const FILE_HASH_TASK* t, const WCHAR* member, ULONGLONG size,
+	BOOL okMd5, const WCHAR* md5, BOOL okSha, const WCHAR* sha)
+{
+	BOOL canceled = (t->bCanceled != 0);
+	const WCHAR* status = ((!t->bCalcMD5 || okMd5) && (!t->bCalcSHA256 || okSha)) ? L"ok" : (canceled ? L"canceled" : L"failed");
+	WCHAR a[MAX_PATH * 2 + 8], b[MAX_PATH * 2 + 8], mtime[32];
+
+	FileTimeToIsoUtc(&t->ftModify, mtime, _countof(mtime));
+	if (member) mtime[0] = L'\0';
+
+	switch (g_nExportFormat) {
+	case HT_EXPORT_CSV:
+		CsvField(t->szFilePath, a, _countof(a));
+		CsvField(member ? member : L"", b, _countof(b));
+		ExportLine_Locked(L"%s,%s,%I64u,%s,%s,%s,%s\r\n", a, b, size, mtime,
+			okMd5 ? md5 : L"", okSha ? sha : L"", status);
+		break;
+
+	case HT_EXPORT_JSONL:
+		JsonString(t->szFilePath, a, _countof(a));
+		ExportLine_Locked(L"{\"path\":\"%s\"", a);
+		if (member) {
+			JsonString(member, b, _countof(b));
+			ExportLine_Locked(L",\"member\":\"%s\"", b);
+		}
+		ExportLine_Locked(L",\"size\":%I64u", size);
+		if (mtime[0]) ExportLine_Locked(L",\"mtime\":\"%s\"", mtime);
+		if (okMd5) ExportLine_Locked(L",\"md5\":\"%s\"", md5);
+		if (okSha) ExportLine_Locked(L",\"sha256\":\"%s\"", sha);
+		ExportLine_Locked(L",\"status\":\"%s\"}\n", status);
+		break;
+
+	case HT_EXPORT_SHA256SUM:
+		// 只写文件本身；'*' = 二进制模式。反斜杠换成 '/'，sha256sum -c 无需转义即可读
+		if (!member && okSha) {
+			StringCchCopyW(a, _countof(a), t->szFilePath);
+			for (WCHAR* p = a; *p; p++) if (*p == L'\\') *p = L'/';
+			ExportLine_Locked(L"%s *%s\n", sha, a);
+		}
+		else {
+			return;
+		}
+		break;
+
+	case HT_EXPORT_BINARY:
+		ExportBin_Locked((BYTE)((okMd5 ? EXPORT_F_MD5 : 0) | (okSha ? EXPORT_F_SHA256 : 0) |
+			(member ? EXPORT_F_MEMBER : 0) | (canceled ? EXPORT_F_CANCELED : 0)),
+			member ? member : t->szFilePath, size, member ? NULL : &t->ftModify, md5, sha);
+		break;
+	}
+	g_ullExportRecords++;
+}
+
+static void ExportTask_Locked(FILE_HASH_TASK* t)
+{
+	if (t->lExportGen == g_lExportGen) return; // 打开导出时已写过
+	t->lExportGen = g_lExportGen;
+
+	ExportRecord_Locked(t, NULL, t->ullFileSize,
+		t->bSuccessMD5, t->szMD5Value, t->bSuccessSHA256, t->szSHA256Value);
+
+	// 任务已完成，成员数组不再变化
+	for (LONG i = 0; i < t->nMembers; i++) {
+		ARCHIVE_MEMBER* m = &t->pMembers[i];
+		ExportRecord_Locked(t, m->szName, m->ullSize,
+			m->bSuccess && t->bCalcMD5, m->szMD5Value, m->bSuccess && t->bCalcSHA256, m->szSHA256Value);
+	}
+}
+
+// FinishTask 调用：导出处于打开状态时追加这一条
+// 监视模式据此忽略导出自己的 <path>.tmp
+static BOOL ExportIsOwnTemp(const WCHAR* base)
+{
+	EnterCriticalSection(&g_csExport);
+	BOOL own = g_bExportOpen && _wcsicmp(g_ExportOut.szOutPath, base) == 0;
+	LeaveCriticalSection(&g_csExport);
+	return own;
+}
+
+static void ExportOnTaskFinished(FILE_HASH_TASK* t)
+{
+	EnterCriticalSection(&g_csExport);
+	if (g_bExportOpen) ExportTask_Locked(t);
+	LeaveCriticalSection(&g_csExport);
+}
+
+static BOOL ExportClose_Locked(void)
+{
+	if (!g_bExportOpen) return FALSE;
+	g_bExportOpen = FALSE;
+
+	EXPORT_BIN_HEADER h;
+	DWORD cbHeader = 0;
+	if (g_nExportFormat == HT_EXPORT_BINARY) {
+		ZeroMemory(&h, sizeof(h));
+		h.dwMagic = EXPORT_BIN_MAGIC;
+		h.wVersion = 1;
+		h.ullCount = g_ullExportRecords;
+		cbHeader = sizeof(h);
+	}
+	else if (g_nExportFormat == HT_EXPORT_CSV) {
+		// Excel 需要 BOM 才按 UTF-8 打开
+		static const BYTE bom[3] = { 0xEF, 0xBB, 0xBF };
+		memcpy(&h, bom, sizeof(bom));
+		cbHeader = sizeof(bom);
+	}
+	return SidecarClose(&g_ExportOut, TRUE, &h, cbHeader);
 }
 
 // ---------------- DLL 导出 API ----------------
@@ -724,8 +4604,21 @@ BOOL __stdcall HT_Init(HT_OnDirty cb, void* user)
 	g_cbUser = user;
 
 	InitializeCriticalSection(&g_csTasks);
+	InitializeCriticalSection(&g_csResume);
+	InitializeCriticalSection(&g_csExport);
+	InitializeCriticalSection(&g_csWatch);
+	InitializeCriticalSection(&g_csThrottle);
+	InitializeCriticalSection(&g_csMem);
+	InitializeConditionVariable(&g_cvMem);
+	InitializeCriticalSection(&g_csSvc);
+	InitializeCriticalSection(&g_csSvcConn);
+	if (!g_hSvcStop) g_hSvcStop = CreateEventW(NULL, TRUE, FALSE, NULL);
 
 	if (!InitCngProviders()) return FALSE;
+	CdcInitGear();
+	InflInitFixed();
+	Crc32Init();
+	if (!g_pZeroBuf) g_pZeroBuf = (BYTE*)VirtualAlloc(NULL, SPARSE_ZERO_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READONLY);
 	EnsureTextCapacity(131072);
 	EnsureThreadPool();
 
@@ -737,6 +4630,12 @@ BOOL __stdcall HT_Init(HT_OnDirty cb, void* user)
 
 void __stdcall HT_Shutdown()
 {
+	// 先停监视与服务，避免关闭线程池时还有新任务提交
+	WatchStop();
+	HT_StopService();
+	while (InterlockedCompareExchange(&g_lSvcRunning, 0, 0) != 0) Sleep(10); // HT_RunService 在别的线程上返回
+	SvcDisconnect();
+
 	// 取消
 	InterlockedExchange(&g_lCancelAll, 1);
 
@@ -752,14 +4651,44 @@ void __stdcall HT_Shutdown()
 	}
 	DestroyThreadpoolEnvironment(&g_callEnv);
 
+	// 读线程都已结束，车道随之收尾，此时车道池已空闲
+	if (g_lanePool) {
+		CloseThreadpool(g_lanePool);
+		g_lanePool = NULL;
+		DestroyThreadpoolEnvironment(&g_laneEnv);
+	}
+
+	// 仍在实时导出：把已写的部分落盘
+	EnterCriticalSection(&g_csExport);
+	ExportClose_Locked();
+	LeaveCriticalSection(&g_csExport);
+
+	for (int i = 0; i < g_nTaskCount; i++) ArchiveFreeMembers_Locked(&g_Tasks[i]);
+	ResumeDropAll();
 	CleanupCngProviders();
 
 	if (g_pTextBuf) {
 		HeapFree(GetProcessHeap(), 0, g_pTextBuf);
 		g_pTextBuf = NULL;
+		MemAccountText(-(LONGLONG)(g_cchTextCap * sizeof(WCHAR)));
 		g_cchTextCap = 0;
 	}
+	if (g_pZeroBuf) {
+		VirtualFree(g_pZeroBuf, 0, MEM_RELEASE);
+		g_pZeroBuf = NULL;
+	}
 
+	if (g_hSvcStop) {
+		CloseHandle(g_hSvcStop);
+		g_hSvcStop = NULL;
+	}
+	DeleteCriticalSection(&g_csSvcConn);
+	DeleteCriticalSection(&g_csSvc);
+	DeleteCriticalSection(&g_csMem);
+	DeleteCriticalSection(&g_csThrottle);
+	DeleteCriticalSection(&g_csWatch);
+	DeleteCriticalSection(&g_csExport);
+	DeleteCriticalSection(&g_csResume);
 	DeleteCriticalSection(&g_csTasks);
 
 	g_cbDirty = NULL;
@@ -774,57 +4703,603 @@ void __stdcall HT_SetThreadCount(int n)
 }
 
 BOOL __stdcall HT_AddFile(const wchar_t* path, BOOL md5, BOOL sha256)
+{
+	InterlockedExchange(&g_lCancelAll, 0); // 调用方重新添加工作：解除 HT_CancelAll
+	return AddTask(path, md5, sha256, NULL, FALSE);
+}
+
+BOOL __stdcall HT_CopyFile(const wchar_t* src, const wchar_t* dst, BOOL md5, BOOL sha256, BOOL verify)
+{
+	if (!src || !src[0] || !dst || !dst[0]) return FALSE;
+
+	// 目标是目录时沿用源文件名
+	WCHAR dest[MAX_PATH];
+	size_t n = wcslen(dst);
+	DWORD attr = GetFileAttributesW(dst);
+	if (dst[n - 1] == L'\\' || dst[n - 1] == L'/' ||
+		(attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY))) {
+		if (!BuildSidecarPath(src, dst, L"", dest, _countof(dest))) return FALSE;
+	}
+	else if (FAILED(StringCchCopyW(dest, _countof(dest), dst))) {
+		return FALSE;
+	}
+	if (_wcsicmp(dest, src) == 0) return FALSE;
+
+	InterlockedExchange(&g_lCancelAll, 0);
+	return AddTask(src, md5, sha256, dest, verify);
+}
+
+void __stdcall HT_SetAppendAware(BOOL enable)
+{
+	InterlockedExchange(&g_bAppendAware, enable ? 1 : 0);
+	if (!enable) ResumeDropAll();
+}
+
+void __stdcall HT_SetChunkManifest(BOOL enable, const wchar_t* outDir)
+{
+	EnterCriticalSection(&g_csTasks);
+	StringCchCopyW(g_szChunkDir, _countof(g_szChunkDir), outDir ? outDir : L"");
+	LeaveCriticalSection(&g_csTasks);
+	InterlockedExchange(&g_bChunkManifest, enable ? 1 : 0);
+}
+
+BOOL __stdcall HT_CompareManifests(const wchar_t* baseManifest, const wchar_t* newManifest,
+	HT_ManifestDiff* out, HT_OnRange cb, void* user)
+{
+	if (!baseManifest || !newManifest || !out) return FALSE;
+	ZeroMemory(out, sizeof(*out));
+
+	BOOL ok = FALSE;
+	CDC_READER ra, rb;
+	CDC_KEY* keys = NULL;
+	size_t nKeys = 0;
+	ULONGLONG runOff = 0, runLen = 0;
+	CDC_MANIFEST_ENTRY e;
+
+	ZeroMemory(&ra, sizeof(ra));
+	ZeroMemory(&rb, sizeof(rb));
+	if (!CdcReaderOpen(&ra, baseManifest) || !CdcReaderOpen(&rb, newManifest)) goto done;
+
+	// 分块参数不同则切点不可比
+	if (ra.hdr.dwMin != rb.hdr.dwMin || ra.hdr.dwAvg != rb.hdr.dwAvg || ra.hdr.dwMax != rb.hdr.dwMax) goto done;
+
+	if (ra.hdr.ullCount > (ULONGLONG)((size_t)-1 / sizeof(CDC_KEY))) goto done;
+	nKeys = (size_t)ra.hdr.ullCount;
+	if (nKeys) {
+		keys = (CDC_KEY*)HeapAlloc(GetProcessHeap(), 0, nKeys * sizeof(CDC_KEY));
+		if (!keys) goto done;
+		for (size_t i = 0; i < nKeys; i++) {
+			if (!CdcReaderNext(&ra, &e)) goto done;
+			memcpy(&keys[i], e.digest, sizeof(CDC_KEY));
+		}
+		qsort(keys, nKeys, sizeof(CDC_KEY), CdcKeyCmp);
+	}
+	out->chunksBase = ra.hdr.ullCount;
+
+	// 以新清单为准：相邻的变更块合并成一个区间回调
+	while (CdcReaderNext(&rb, &e)) {
+		CDC_KEY k;
+		memcpy(&k, e.digest, sizeof(k));
+		BOOL shared = nKeys && bsearch(&k, keys, nKeys, sizeof(CDC_KEY), CdcKeyCmp) != NULL;
+
+		out->chunksNew++;
+		if (shared) {
+			out->sharedChunks++;
+			out->sharedBytes += e.dwLength;
+			if (runLen && cb) cb(user, runOff, runLen);
+			runLen = 0;
+		}
+		else {
+			out->changedChunks++;
+			out->changedBytes += e.dwLength;
+			if (runLen && runOff + runLen == e.ullOffset) {
+				runLen += e.dwLength;
+			}
+			else {
+				if (runLen && cb) cb(user, runOff, runLen);
+				runOff = e.ullOffset;
+				runLen = e.dwLength;
+			}
+		}
+	}
+	if (runLen && cb) cb(user, runOff, runLen);
+
+	ok = (rb.ullLeft == 0);
+
+done:
+	CdcReaderClose(&ra);
+	CdcReaderClose(&rb);
+	if (keys) HeapFree(GetProcessHeap(), 0, keys);
+	return ok;
+}
+
+void __stdcall HT_SetPieceHashes(DWORD pieceSize, const wchar_t* outDir)
+{
+	if (pieceSize == 1) pieceSize = PIECE_DEFAULT_SIZE;
+	EnterCriticalSection(&g_csTasks);
+	StringCchCopyW(g_szPieceDir, _countof(g_szPieceDir), outDir ? outDir : L"");
+	LeaveCriticalSection(&g_csTasks);
+	InterlockedExchange(&g_lPieceSize, (LONG)NormalizePieceSize(pieceSize));
+}
+
+BOOL __stdcall HT_VerifyPieces(const wchar_t* path, const wchar_t* pieceList,
+	const HT_Range* ranges, int nRanges, HT_PieceVerify* out, HT_OnRange cb, void* user)
+{
+	if (!path || !path[0]) return FALSE;
+
+	HT_PieceVerify res;
+	ZeroMemory(&res, sizeof(res));
+
+	BOOL ok = FALSE;
+	WCHAR listPath[MAX_PATH];
+	HANDLE hList = INVALID_HANDLE_VALUE, hFile = INVALID_HANDLE_VALUE;
+	BYTE* want = NULL;
+	BYTE* buf = NULL;
+	DWORD cbBuf = 0;
+	PIECE_LIST_HEADER h;
+	DWORD got = 0;
+	ULONGLONG realSize = 0;
+	ULONGLONG badOff = 0, badLen = 0;
+	ULONGLONG nextPos = (ULONGLONG)-1;
+	DWORD vol = 0;
+	LARGE_INTEGER li;
+
+	if (pieceList && pieceList[0]) StringCchCopyW(listPath, _countof(listPath), pieceList);
+	else if (!BuildSidecarPath(path, NULL, L".htpc", listPath, _countof(listPath))) return FALSE;
+
+	hList = CreateFileW(listPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hList == INVALID_HANDLE_VALUE) goto done;
+	if (!ReadFull(hList, (BYTE*)&h, sizeof(h), &got) || got != sizeof(h)) goto done;
+	if (h.dwMagic != PIECE_LIST_MAGIC || h.wVersion != 1 || h.wDigestLen != 32) goto done;
+	if (h.dwPieceSize < PIECE_MIN_SIZE || h.dwPieceSize > IO_BUF_SIZE) goto done;
+	if (h.ullCount / 8 + 1 > (ULONGLONG)(size_t)-1) goto done;
+
+	hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE) goto done;
+	if (GetFileSizeEx(hFile, &li)) realSize = (ULONGLONG)li.QuadPart;
+	vol = VolumeOfHandle(hFile);
+	BackgroundSync(); // 在调用方线程上同步执行：后台模式与限速同样适用，done 处恢复
+
+	// 需要校验的分片位图：ranges 为空 = 全部
+	want = (BYTE*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, (size_t)(h.ullCount / 8 + 1));
+	// 同步调用没有任务可取消：HT_CancelAll 打断等待
+	buf = MemAcquire(h.dwPieceSize, h.dwPieceSize, &cbBuf, TRUE, NULL);
+	if (!want || !buf) goto done;
+
+	if (!ranges || nRanges <= 0) {
+		for (ULONGLONG i = 0; i < h.ullCount; i++) want[i >> 3] |= (BYTE)(1 << (i & 7));
+	}
+	else {
+		for (int r = 0; r < nRanges; r++) {
+			if (ranges[r].length == 0 || ranges[r].offset >= h.ullFileSize) continue;
+			// 先把长度截到清单覆盖范围内，offset + length 才不会回绕
+			ULONGLONG len = h.ullFileSize - ranges[r].offset;
+			if (ranges[r].length < len) len = ranges[r].length;
+			ULONGLONG first = ranges[r].offset / h.dwPieceSize;
+			ULONGLONG last = (ranges[r].offset + len - 1) / h.dwPieceSize;
+			if (last >= h.ullCount) last = h.ullCount - 1;
+			for (ULONGLONG i = first; i <= last; i++) want[i >> 3] |= (BYTE)(1 << (i & 7));
+		}
+	}
+
+	ok = TRUE;
+	for (ULONGLONG i = 0; i < h.ullCount; i++) {
+		if (!(want[i >> 3] & (1 << (i & 7)))) continue;
+		if (InterlockedCompareExchange(&g_lCancelAll, 0, 0) != 0) { ok = FALSE; break; }
+
+		ULONGLONG off = i * h.dwPieceSize;
+		DWORD len = (DWORD)((h.ullFileSize - off < h.dwPieceSize) ? (h.ullFileSize - off) : h.dwPieceSize);
+
+		BYTE expect[32], actual[32];
+		li.QuadPart = (LONGLONG)(sizeof(h) + i * 32);
+		if (!SetFilePointerEx(hList, li, NULL, FILE_BEGIN) ||
+			!ReadFull(hList, expect, sizeof(expect), &got) || got != sizeof(expect)) { ok = FALSE; break; }
+
+		// 连续分片不重复定位
+		if (off != nextPos) {
+			li.QuadPart = (LONGLONG)off;
+			if (!SetFilePointerEx(hFile, li, NULL, FILE_BEGIN)) { ok = FALSE; break; }
+		}
+
+		// 读错误、截断都算损坏
+		BOOL bad = TRUE;
+		if (ThrottledReadFull(hFile, buf, len, &got, vol) && got == len && Sha256OfBuf(buf, len, actual)) {
+			bad = (memcmp(expect, actual, sizeof(actual)) != 0);
+		}
+		nextPos = off + got;
+		res.bytesRead += got;
+		res.piecesChecked++;
+
+		if (bad) {
+			res.piecesBad++;
+			res.badBytes += len;
+			if (badLen && badOff + badLen == off) {
+				badLen += len;
+			}
+			else {
+				if (badLen && cb) cb(user, badOff, badLen);
+				badOff = off;
+				badLen = len;
+			}
+		}
+	}
+	if (badLen && cb) cb(user, badOff, badLen);
+
+	// 全量校验时，超出清单长度的尾部也算差异（截断已体现在分片里）
+	if (ok && (!ranges || nRanges <= 0) && realSize > h.ullFileSize) {
+		res.badBytes += realSize - h.ullFileSize;
+		if (cb) cb(user, h.ullFileSize, realSize - h.ullFileSize);
+	}
+
+done:
+	BackgroundLeave();
+	MemRelease(buf, cbBuf);
+	if (want) HeapFree(GetProcessHeap(), 0, want);
+	if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+	if (hList != INVALID_HANDLE_VALUE) CloseHandle(hList);
+	if (out) *out = res;
+	return ok;
+}
+
+void __stdcall HT_SetArchiveMembers(BOOL enable)
+{
+	InterlockedExchange(&g_bArchiveMembers, enable ? 1 : 0);
+}
+
+BOOL __stdcall HT_Export(const wchar_t* path, int format, BOOL live)
 {
 	if (!path || !path[0]) return FALSE;
+	if (format < HT_EXPORT_CSV || format > HT_EXPORT_BINARY) return FALSE;
+
+	EnterCriticalSection(&g_csExport);
+	if (g_bExportOpen) ExportClose_Locked();
+
+	DWORD cbHeader = 0;
+	if (format == HT_EXPORT_BINARY) cbHeader = sizeof(EXPORT_BIN_HEADER);
+	else if (format == HT_EXPORT_CSV) cbHeader = 3; // BOM
+
+	BOOL ok = SidecarOpenPath(&g_ExportOut, path, cbHeader);
+	if (ok) {
+		g_bExportOpen = TRUE;
+		g_nExportFormat = format;
+		g_ullExportRecords = 0;
+		g_lExportGen++;
+		if (format == HT_EXPORT_CSV) ExportLine_Locked(L"path,member,size,mtime,md5,sha256,status\r\n");
+
+		// 先写已完成的任务；之后完成的由 FinishTask 追加
+		for (int i = 0;; i++) {
+			FILE_HASH_TASK* t = NULL;
+			EnterCriticalSection(&g_csTasks);
+			if (i < g_nTaskCount) t = &g_Tasks[i];
+			LeaveCriticalSection(&g_csTasks);
+			if (!t) break;
+			if (InterlockedCompareExchange(&t->bFinished, 0, 0) != 0) ExportTask_Locked(t);
+		}
+
+		if (live) ok = !g_ExportOut.bFailed;
+		else ok = ExportClose_Locked();
+	}
+	else {
+		SidecarClose(&g_ExportOut, FALSE, NULL, 0);
+	}
+	LeaveCriticalSection(&g_csExport);
+	return ok;
+}
+
+BOOL __stdcall HT_ExportClose()
+{
+	EnterCriticalSection(&g_csExport);
+	BOOL ok = ExportClose_Locked();
+	LeaveCriticalSection(&g_csExport);
+	return ok;
+}
+
+BOOL __stdcall HT_WatchDirectory(const wchar_t* dir, BOOL recursive, BOOL md5, BOOL sha256, DWORD debounceMs)
+{
+	if (!dir || !dir[0]) return FALSE;
 	if (!md5 && !sha256) return FALSE;
 
 	EnsureThreadPool();
 	if (!g_pool) return FALSE;
+	InterlockedExchange(&g_lCancelAll, 0); // 新监视也算重新添加工作，积压的变化随之提交
 
-	EnsureOverallStart();
-	InterlockedExchange(&g_lCancelAll, 0);
+	BOOL ok = FALSE;
+	EnterCriticalSection(&g_csWatch);
+	if (g_nWatch < MAX_WATCH) {
+		WATCH_DIR* w = &g_Watch[g_nWatch];
+		ZeroMemory(w, sizeof(*w));
+		StringCchCopyW(w->szDir, _countof(w->szDir), dir);
+		w->bRecursive = recursive;
+		w->bMD5 = md5;
+		w->bSHA = sha256;
+		w->dwDebounceMs = debounceMs ? debounceMs : WATCH_DEFAULT_DEBOUNCE_MS;
+
+		w->hDir = CreateFileW(dir, FILE_LIST_DIRECTORY,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+		w->ov.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+		w->buf = (BYTE*)HeapAlloc(GetProcessHeap(), 0, WATCH_BUF_SIZE); // 需 DWORD 对齐，堆分配满足
+
+		if (!g_hWatchThread) {
+			InterlockedExchange(&g_lWatchStop, 0);
+			g_hWatchWake = CreateEventW(NULL, FALSE, FALSE, NULL);
+			if (g_hWatchWake) g_hWatchThread = CreateThread(NULL, 0, WatchThreadProc, NULL, 0, NULL);
+		}
 
-	EnterCriticalSection(&g_csTasks);
+		if (w->hDir != INVALID_HANDLE_VALUE && w->ov.hEvent && w->buf && g_hWatchThread) {
+			g_nWatch++;
+			ok = TRUE;
+		}
+		else {
+			if (w->hDir != INVALID_HANDLE_VALUE) CloseHandle(w->hDir);
+			if (w->ov.hEvent) CloseHandle(w->ov.hEvent);
+			if (w->buf) HeapFree(GetProcessHeap(), 0, w->buf);
+			ZeroMemory(w, sizeof(*w));
+		}
+	}
+	LeaveCriticalSection(&g_csWatch);
 
-	// 新批次：清零计数（保持你原 StartFiles 行为）
-	if (g_nTaskCount == 0) {
-		InterlockedExchange64(&g_llDoneBytesAll, 0);
-		InterlockedExchange64(&g_llTotalBytesAll, 0);
-		g_ullOverallStartTick = NowTick64();
+	if (ok) SetEvent(g_hWatchWake); // 由监视线程发起首次读取
+	return ok;
+}
+
+void __stdcall HT_StopWatch()
+{
+	WatchStop();
+}
+
+void __stdcall HT_SetBandwidthLimit(uint64_t bytesPerSec)
+{
+	EnterCriticalSection(&g_csThrottle);
+	BucketSetRate(&g_BucketAll, bytesPerSec);
+	ThrottleRecalc_Locked();
+	LeaveCriticalSection(&g_csThrottle);
+}
+
+BOOL __stdcall HT_SetVolumeBandwidthLimit(const wchar_t* path, uint64_t bytesPerSec)
+{
+	if (!path || !path[0]) return FALSE;
+
+	WCHAR root[MAX_PATH];
+	DWORD serial = 0;
+	if (!GetVolumePathNameW(path, root, _countof(root))) return FALSE;
+	if (!GetVolumeInformationW(root, NULL, 0, &serial, NULL, NULL, NULL, 0)) return FALSE;
+
+	BOOL ok = TRUE;
+	EnterCriticalSection(&g_csThrottle);
+	IO_BUCKET* b = BucketFind_Locked(serial);
+	if (!bytesPerSec) {
+		if (b) *b = g_Buckets[--g_nBuckets];
+	}
+	else if (b) {
+		BucketSetRate(b, bytesPerSec);
+	}
+	else if (g_nBuckets < MAX_IO_BUCKETS) {
+		b = &g_Buckets[g_nBuckets++];
+		b->dwVolume = serial;
+		BucketSetRate(b, bytesPerSec);
 	}
 	else {
-		// 追加：若上一轮已完成，将 done 对齐 total
-		if (InterlockedCompareExchange(&g_lRunningCount, 0, 0) == 0) {
-			LONGLONG total = InterlockedCompareExchange64(&g_llTotalBytesAll, 0, 0);
-			InterlockedExchange64(&g_llDoneBytesAll, total);
+		ok = FALSE;
+	}
+	ThrottleRecalc_Locked();
+	LeaveCriticalSection(&g_csThrottle);
+	return ok;
+}
+
+void __stdcall HT_SetBackgroundMode(BOOL enable)
+{
+	InterlockedExchange(&g_lBackground, enable ? 1 : 0);
+}
+
+void __stdcall HT_SetMemoryBudget(uint64_t bytes)
+{
+	EnterCriticalSection(&g_csMem);
+	g_ullMemBudget = bytes;
+	LeaveCriticalSection(&g_csMem);
+	WakeAllConditionVariable(&g_cvMem); // 放宽时让等待者重新计算
+}
+
+// 服务端：阻塞运行直到 HT_StopService、客户端发来停止请求或出错；pipeName 为空时用默认名
+BOOL __stdcall HT_RunService(const wchar_t* pipeName)
+{
+	const WCHAR* name = (pipeName && pipeName[0]) ? pipeName : SVC_DEFAULT_PIPE;
+	OVERLAPPED ov;
+	DWORD got = 0;
+	BOOL ok = FALSE;
+
+	EnsureThreadPool();
+	if (!g_pool || !g_hSvcStop) return FALSE;
+
+	// 复位停止事件与发布运行标志在同一把锁内：HT_StopService 看到运行中就一定能让本次返回
+	EnterCriticalSection(&g_csSvc);
+	BOOL busy = (g_lSvcRunning != 0);
+	if (!busy) {
+		ResetEvent(g_hSvcStop);
+		InterlockedExchange(&g_lSvcRunning, 1);
+	}
+	LeaveCriticalSection(&g_csSvc);
+	if (busy) return FALSE;
+
+	ZeroMemory(&ov, sizeof(ov));
+	ZeroMemory(g_SvcClients, sizeof(g_SvcClients));
+	ov.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	BOOL ready = (ov.hEvent != NULL);
+	for (int i = 0; i < SVC_MAX_CLIENTS; i++) {
+		SVC_CLIENT* c = &g_SvcClients[i];
+		c->hPipe = INVALID_HANDLE_VALUE;
+		c->hQueued = CreateEventW(NULL, FALSE, FALSE, NULL);
+		c->hWrite = CreateEventW(NULL, TRUE, FALSE, NULL);
+		c->q = (SVC_RESULT*)HeapAlloc(GetProcessHeap(), 0, SVC_QUEUE_LEN * sizeof(SVC_RESULT));
+		if (!c->hQueued || !c->hWrite || !c->q) ready = FALSE;
+	}
+
+	for (BOOL first = TRUE; ready; first = FALSE) {
+		// 首个实例独占名字：同名服务已在运行时直接失败
+		HANDLE hPipe = CreateNamedPipeW(name,
+			PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+			PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+			PIPE_UNLIMITED_INSTANCES, SVC_PIPE_BUF, SVC_PIPE_BUF, 0, NULL);
+		if (hPipe == INVALID_HANDLE_VALUE) break;
+		ok = TRUE;
+
+		BOOL connected = ConnectNamedPipe(hPipe, &ov);
+		if (!connected) {
+			DWORD e = GetLastError();
+			if (e == ERROR_PIPE_CONNECTED) {
+				connected = TRUE;
+			}
+			else if (e == ERROR_IO_PENDING) {
+				HANDLE hs[2] = { ov.hEvent, g_hSvcStop };
+				if (WaitForMultipleObjects(2, hs, FALSE, INFINITE) == WAIT_OBJECT_0) {
+					connected = GetOverlappedResult(hPipe, &ov, &got, FALSE);
+				}
+				else {
+					CancelIoEx(hPipe, &ov);
+					GetOverlappedResult(hPipe, &ov, &got, TRUE);
+				}
+			}
+		}
+
+		if (connected && !SvcAttach(hPipe)) {
+			// 槽位已满：回一条 BUSY 再关闭（不 DisconnectNamedPipe，客户端仍能读到）
+			SVC_RESULT r;
+			ZeroMemory(&r, sizeof(r));
+			r.dwMagic = SVC_MAGIC_RES;
+			r.dwStatus = SVC_ST_BUSY;
+			SvcWrite(hPipe, ov.hEvent, &r, sizeof(r));
+			CloseHandle(hPipe);
+		}
+		else if (!connected) {
+			CloseHandle(hPipe);
 		}
+		if (WaitForSingleObject(g_hSvcStop, 0) == WAIT_OBJECT_0) break;
 	}
 
-	AddOneFile_Locked(path, md5, sha256);
+	// 收尾：唤醒并等待所有客户端线程；写阻塞的线程靠 CancelIoEx 打断
+	SetEvent(g_hSvcStop);
+	for (int i = 0; i < SVC_MAX_CLIENTS; i++) {
+		SVC_CLIENT* c = &g_SvcClients[i];
+		while (c->hThread && WaitForSingleObject(c->hThread, 100) == WAIT_TIMEOUT) {
+			EnterCriticalSection(&g_csSvc);
+			if (c->bUsed) CancelIoEx(c->hPipe, NULL);
+			LeaveCriticalSection(&g_csSvc);
+		}
+		if (c->hThread) CloseHandle(c->hThread);
+		if (c->hQueued) CloseHandle(c->hQueued);
+		if (c->hWrite) CloseHandle(c->hWrite);
+		if (c->q) HeapFree(GetProcessHeap(), 0, c->q);
+	}
+	ZeroMemory(g_SvcClients, sizeof(g_SvcClients));
 
+	EnterCriticalSection(&g_csTasks);
+	for (int i = 0; i < g_nTaskCount; i++) InterlockedExchange(&g_Tasks[i].lSvcWaiters, 0);
 	LeaveCriticalSection(&g_csTasks);
 
-	MarkTextDirtyAndRequest();
-	return TRUE;
+	if (ov.hEvent) CloseHandle(ov.hEvent);
+	EnterCriticalSection(&g_csSvc);
+	InterlockedExchange(&g_lSvcRunning, 0);
+	LeaveCriticalSection(&g_csSvc);
+	return ok;
+}
+
+void __stdcall HT_StopService()
+{
+	EnterCriticalSection(&g_csSvc);
+	if (g_lSvcRunning) SetEvent(g_hSvcStop);
+	LeaveCriticalSection(&g_csSvc);
+}
+
+// rundll32 入口：rundll32 HashTool.Core.dll,HT_ServiceMain [管道名]
+void CALLBACK HT_ServiceMainW(HWND hwnd, HINSTANCE hinst, LPWSTR cmdLine, int nCmdShow)
+{
+	(void)hwnd; (void)hinst; (void)nCmdShow;
+	while (cmdLine && (*cmdLine == L' ' || *cmdLine == L'\t')) cmdLine++;
+
+	if (!HT_Init(NULL, NULL)) return;
+	HT_SetAppendAware(TRUE); // 续算中间态只活在进程内，常驻服务正好替各客户端保留
+	HT_RunService(cmdLine);
+	HT_Shutdown();
+}
+
+// 客户端：连上后 HT_AddFile（及监视模式）转发给服务；复制任务仍在本进程执行
+BOOL __stdcall HT_ConnectService(const wchar_t* pipeName)
+{
+	const WCHAR* name = (pipeName && pipeName[0]) ? pipeName : SVC_DEFAULT_PIPE;
+
+	if (g_hSvcConnThread) {
+		if (SvcConnActive()) return TRUE;
+		SvcDisconnect(); // 上次连接已断开，先回收
+	}
+
+	HANDLE h = INVALID_HANDLE_VALUE;
+	for (int tries = 0; tries < 3; tries++) {
+		// 只允许服务端识别身份，不允许冒充客户端
+		h = CreateFileW(name, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+			FILE_FLAG_OVERLAPPED | SECURITY_SQOS_PRESENT | SECURITY_IDENTIFICATION, NULL);
+		if (h != INVALID_HANDLE_VALUE || GetLastError() != ERROR_PIPE_BUSY) break;
+		if (!WaitNamedPipeW(name, 2000)) break;
+	}
+	if (h == INVALID_HANDLE_VALUE) return FALSE;
+
+	DWORD mode = PIPE_READMODE_MESSAGE;
+	g_hSvcConnStop = CreateEventW(NULL, TRUE, FALSE, NULL);
+	g_hSvcConnWrite = CreateEventW(NULL, TRUE, FALSE, NULL);
+	if (SetNamedPipeHandleState(h, &mode, NULL, NULL) && g_hSvcConnStop && g_hSvcConnWrite) {
+		g_hSvcConn = h;
+		InterlockedExchange(&g_lSvcConnected, 1);
+		g_hSvcConnThread = CreateThread(NULL, 0, SvcConnReaderProc, NULL, 0, NULL);
+		if (g_hSvcConnThread) return TRUE;
+		InterlockedExchange(&g_lSvcConnected, 0);
+		g_hSvcConn = INVALID_HANDLE_VALUE;
+	}
+
+	CloseHandle(h);
+	if (g_hSvcConnStop) CloseHandle(g_hSvcConnStop);
+	if (g_hSvcConnWrite) CloseHandle(g_hSvcConnWrite);
+	g_hSvcConnStop = NULL;
+	g_hSvcConnWrite = NULL;
+	return FALSE;
+}
+
+void __stdcall HT_DisconnectService()
+{
+	SvcDisconnect();
 }
 
 void __stdcall HT_CancelAll()
 {
+	// 全局标志一直保持到调用方下次 HT_AddFile/HT_CopyFile/HT_WatchDirectory；
+	// 已提交的任务逐个标记，之后即使标志被解除也不会继续算
 	InterlockedExchange(&g_lCancelAll, 1);
+	EnterCriticalSection(&g_csTasks);
+	for (int i = 0; i < g_nTaskCount; i++) {
+		FILE_HASH_TASK* t = &g_Tasks[i];
+		if (!t->bRemote && InterlockedCompareExchange(&t->bFinished, 0, 0) == 0) InterlockedExchange(&t->bCanceled, 1);
+	}
+	LeaveCriticalSection(&g_csTasks);
+	SvcConnFinishPending(TRUE); // 服务端照常算完，供其他客户端复用
 	MarkTextDirtyAndRequest();
 }
 
 BOOL __stdcall HT_ClearAll()
 {
-	if (InterlockedCompareExchange(&g_lRunningCount, 0, 0) != 0) return FALSE;
-
+	// 监视线程在 g_csTasks 内重新提交任务，所以在锁内判断
 	EnterCriticalSection(&g_csTasks);
+	if (InterlockedCompareExchange(&g_lRunningCount, 0, 0) != 0) {
+		LeaveCriticalSection(&g_csTasks);
+		return FALSE;
+	}
+	for (int i = 0; i < g_nTaskCount; i++) ArchiveFreeMembers_Locked(&g_Tasks[i]);
 	ZeroMemory(g_Tasks, sizeof(g_Tasks));
 	g_nTaskCount = 0;
 	LeaveCriticalSection(&g_csTasks);
 
 	InterlockedExchange64(&g_llTotalBytesAll, 0);
 	InterlockedExchange64(&g_llDoneBytesAll, 0);
+	InterlockedExchange64(&g_llSparseBytesAll, 0);
+	MemResetPeak();
 	InterlockedExchange(&g_lCancelAll, 0);
 	g_ullOverallStartTick = 0;
 
@@ -864,6 +5339,13 @@ void __stdcall HT_GetSummary(HT_Summary* out)
 	out->mbps = mbps;
 	out->runningCount = (int)InterlockedCompareExchange(&g_lRunningCount, 0, 0);
 	out->poolThreads = (int)g_lPoolThreads;
+	out->sparseBytes = (uint64_t)InterlockedCompareExchange64(&g_llSparseBytesAll, 0, 0);
+
+	EnterCriticalSection(&g_csMem);
+	out->memInUse = (uint64_t)(g_llMemIo + g_llMemText);
+	out->memPeak = (uint64_t)g_llMemPeak;
+	out->memBudget = g_ullMemBudget;
+	LeaveCriticalSection(&g_csMem);
 }
 
 int __stdcall HT_GetTextLength()
@@ -17,6 +17,7 @@
 #endif
 
 typedef void(__stdcall* HT_OnDirty)(void* user);
+typedef void(__stdcall* HT_OnRange)(void* user, uint64_t offset, uint64_t length);
 
 typedef struct HT_Summary {
 	int percent;                 // 0..100
@@ -25,8 +26,41 @@ typedef struct HT_Summary {
 	double mbps;
 	int runningCount;
 	int poolThreads;
+	uint64_t sparseBytes;        // ϡնֱӲ㡢δ̵ֽ
+	uint64_t memInUse;           // I/O  + ı嵱ǰռ
+	uint64_t memPeak;            // ηֵ
+	uint64_t memBudget;          // 0 = 
 } HT_Summary;
 
+typedef struct HT_ManifestDiff {
+	uint64_t chunksBase;         // ׼嵥
+	uint64_t chunksNew;          // 嵥
+	uint64_t sharedChunks;       // 嵥ڻ׼ֹĿ
+	uint64_t sharedBytes;
+	uint64_t changedChunks;
+	uint64_t changedBytes;
+} HT_ManifestDiff;
+
+typedef struct HT_Range {
+	uint64_t offset;
+	uint64_t length;
+} HT_Range;
+
+// HT_Export ʽ
+typedef enum HT_ExportFormat {
+	HT_EXPORT_CSV = 0,           // path,member,size,mtime,md5,sha256,statusUTF-8  BOM
+	HT_EXPORT_JSONL = 1,         // ÿһ JSON 
+	HT_EXPORT_SHA256SUM = 2,     // "<sha256> *<path>" SHA256 ļ
+	HT_EXPORT_BINARY = 3,        // 'HTEX' ͷ + ¼ + UTF-16 
+} HT_ExportFormat;
+
+typedef struct HT_PieceVerify {
+	uint64_t piecesChecked;
+	uint64_t piecesBad;
+	uint64_t bytesRead;          // ʵʶȡֽ
+	uint64_t badBytes;
+} HT_PieceVerify;
+
 // ʼ/ͷ
 HT_API BOOL  __stdcall HT_Init(HT_OnDirty cb, void* user);
 HT_API void  __stdcall HT_Shutdown();
@@ -34,11 +68,67 @@ HT_API void  __stdcall HT_Shutdown();
 // ̳߳߳
 HT_API void  __stdcall HT_SetThreadCount(int n);
 
+// ٣Ͱֽ/룬0 = ޣȫ֣Լpath Ϊþ·
+// ͬʱЧνпʱ
+HT_API void  __stdcall HT_SetBandwidthLimit(uint64_t bytesPerSec);
+HT_API BOOL  __stdcall HT_SetVolumeBandwidthLimit(const wchar_t* path, uint64_t bytesPerSec);
+// ̨ģʽ߳ THREAD_MODE_BACKGROUND УCPU  I/O ȼͣһζȡЧ
+HT_API void  __stdcall HT_SetBackgroundMode(BOOL enable);
+// ڴԤ㣨ֽڣ0 = ޣʱС顢ݻ񣬶ʧܡ
+// ֻԼ I/O 壻ı HT_Summary  memInUse/memPeak
+HT_API void  __stdcall HT_SetMemoryBudget(uint64_t bytes);
+
 // 
 HT_API BOOL  __stdcall HT_AddFile(const wchar_t* path, BOOL md5, BOOL sha256);
+// ߸Ʊ߹ϣԴֻһ飬дĿһصdst ΪĿ¼ʱԴļ
+// verify=TRUE ʱ޻ I/O ضĿȶժҪһ²
+HT_API BOOL  __stdcall HT_CopyFile(const wchar_t* src, const wchar_t* dst, BOOL md5, BOOL sha256, BOOL verify);
+// ȡȫֵ´ HT_AddFile/HT_CopyFile/HT_WatchDirectoryڼӵı仯ֻŶӲ
 HT_API void  __stdcall HT_CancelAll();
 HT_API BOOL  __stdcall HT_ClearAll(); // running!=0  FALSE
 
+// ϣܵpipeName Ϊ = \\.\pipe\HashTool.Core
+// ˣHT_RunService УϲͬһļĲ 32 ͻˣ
+// Ҳ rundll32 HashTool.Core.dll,HT_ServiceMain [ܵ] С
+HT_API BOOL  __stdcall HT_RunService(const wchar_t* pipeName);
+HT_API void  __stdcall HT_StopService();
+HT_API void  CALLBACK  HT_ServiceMainW(HWND hwnd, HINSTANCE hinst, LPWSTR cmdLine, int nCmdShow);
+// ͻˣϺ HT_AddFile/ģʽת񣬽ճı뵼Уڱִ
+HT_API BOOL  __stdcall HT_ConnectService(const wchar_t* pipeName);
+HT_API void  __stdcall HT_DisconnectService();
+
+// ģʽĿ¼ļ/޸ĺ󣬾Ĭ debounceMs0 = 500msύ
+// ͬһ·ĶαϲΪһΣԭ㡣 16 Ŀ¼
+HT_API BOOL  __stdcall HT_WatchDirectory(const wchar_t* dir, BOOL recursive, BOOL md5, BOOL sha256, DWORD debounceMs);
+HT_API void  __stdcall HT_StopWatch(); // ֹͣȫ
+
+// ׷Ӹ֪ϴιϣм̬βָƣļֻʱϣ֡
+// мֻ̬ڱڴУ MAX_TASKS ļδ̭д·ļ
+// ˳ HT_Shutdown ʧЧ´ȫỰ뾭 HT_ConnectService פHT_ServiceMain ķĬϿܣ
+HT_API void  __stdcall HT_SetAppendAware(BOOL enable);
+
+// ֿ嵥FastCDCͬһȡап飬 <ļ>.htcmoutDir ΪʱԴļͬĿ¼
+HT_API void  __stdcall HT_SetChunkManifest(BOOL enable, const wchar_t* outDir);
+// Ƚ嵥cb 嵥ƫƻص䣨ڿѺϲΪ NULL
+HT_API BOOL  __stdcall HT_CompareManifests(const wchar_t* baseManifest, const wchar_t* newManifest,
+	HT_ManifestDiff* out, HT_OnRange cb, void* user);
+
+// Ƭϣ pieceSize2 ݣ64KB..8MB 1 ȡĬ 4MB0 رգ <ļ>.htpc
+HT_API void  __stdcall HT_SetPieceHashes(DWORD pieceSize, const wchar_t* outDir);
+// ƬбУ飻ranges Ϊ NULL ʱУȫֻȡ ranges ཻķƬ
+// pieceList Ϊ NULL ʱȡԴļԵ .htpccb ص䣨ڷƬѺϲ
+HT_API BOOL  __stdcall HT_VerifyPieces(const wchar_t* path, const wchar_t* pieceList,
+	const HT_Range* ranges, int nRanges, HT_PieceVerify* out, HT_OnRange cb, void* user);
+
+// 鵵Աϣ.zip/.tar/.tar.gz/.tgz/.gz гÿԱѹݣĹϣ̡
+// tar/gz ļϣһȡzip Ŀ¼ѳԱύ̳߳
+HT_API void  __stdcall HT_SetArchiveMembers(BOOL enable);
+
+//  formatHT_ExportFormatʽд pathд .tmpرʱ
+// live=FALSE ʱд꼴رգlive=TRUE ʱִ򿪣˺ÿɼ׷ӣֱ HT_ExportClose
+HT_API BOOL  __stdcall HT_Export(const wchar_t* path, int format, BOOL live);
+HT_API BOOL  __stdcall HT_ExportClose();
+
 // ѯ
 HT_API void  __stdcall HT_GetSummary(HT_Summary* out);
 